@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "Raster.h"
+#include "ThreadPool.h"
+#include "scene/scene.h"
+#include "scene/camera.h"
+
+// pixels on a side of a tile
+static const int RASTER_TILE = 32;
+
+// how far outside its outline, in pixels, an object is still tried
+static const double RASTER_MARGIN = 1.0;
+
+// hits closer together than this are left to Scene::intersect, which
+// settles them by the octree's order
+static const double RASTER_TIE = 2 * RAY_EPSILON;
+
+PrimaryRaster::PrimaryRaster( Scene *scene, ThreadPool *pool )
+	: scene( scene ), pool( pool ), width( 0 ), height( 0 ), tilesWide( 0 )
+{
+}
+
+void PrimaryRaster::render( int width, int height, std::deque<isect>& hits, vector<char>& found )
+{
+	this->width = width;
+	this->height = height;
+	size_t n = (size_t)width * height;
+	if( hits.size() < n )
+		hits.resize( n );
+	found.assign( n, 0 );
+	if( !n )
+		return;
+
+	covers.clear();
+	Scene::cgiter j;
+	for( j = scene->beginNonboundedObjects(); j != scene->endNonboundedObjects(); ++j ) {
+		Cover c;
+		c.obj = *j;
+		c.near = 0.0;
+		c.x0 = c.y0 = 0;
+		c.x1 = width - 1;
+		c.y1 = height - 1;
+		c.triangle = false;
+		covers.push_back( c );
+	}
+	for( j = scene->beginBoundedObjects(); j != scene->endBoundedObjects(); ++j )
+		cover( *j );
+	std::stable_sort( covers.begin(), covers.end(),
+		[]( const Cover& a, const Cover& b ) { return a.near < b.near; } );
+
+	tilesWide = (width + RASTER_TILE - 1) / RASTER_TILE;
+	int tilesHigh = (height + RASTER_TILE - 1) / RASTER_TILE;
+	tiles.assign( (size_t)tilesWide * tilesHigh, vector<int>() );
+	for( int c = 0; c < (int)covers.size(); ++c )
+		for( int ty = covers[c].y0 / RASTER_TILE; ty <= covers[c].y1 / RASTER_TILE; ++ty )
+			for( int tx = covers[c].x0 / RASTER_TILE; tx <= covers[c].x1 / RASTER_TILE; ++tx )
+				tiles[tx + (size_t)ty * tilesWide].push_back( c );
+
+	std::function<void(int)> job = [this, &hits, &found]( int tile ) {
+		renderTile( tile, hits, found );
+	};
+	if( pool && pool->size() > 1 )
+		pool->run( (int)tiles.size(), job );
+	else
+		for( int tile = 0; tile < (int)tiles.size(); ++tile )
+			job( tile );
+}
+
+// Project obj's triangle or the corners of its box, and add the pixels
+// they fall over to covers, unless that's none of them.
+void PrimaryRaster::cover( const Geometry *obj )
+{
+	Camera *camera = scene->getCamera();
+	const BoundingBox& box = obj->getBoundingBox();
+	vec3f eye = camera->getEye();
+
+	Cover c;
+	c.obj = obj;
+	vec3f nearest = minimum( maximum( eye, box.min ), box.max );
+	c.near = (nearest - eye).length();
+	c.x0 = c.y0 = 0;
+	c.x1 = width - 1;
+	c.y1 = height - 1;
+	c.triangle = false;
+
+	vec3f corner[8];
+	int n = 3;
+	if( !obj->getTriangle( corner[0], corner[1], corner[2] ) ) {
+		n = 8;
+		for( int k = 0; k < 8; ++k )
+			corner[k] = vec3f( (k & 1) ? box.max[0] : box.min[0],
+							   (k & 2) ? box.max[1] : box.min[1],
+							   (k & 4) ? box.max[2] : box.min[2] );
+	}
+
+	// With every corner in front of the eye, the object is seen inside
+	// their outline, with every one behind it, not at all.  Else it could
+	// be anywhere.
+	double px[8], py[8];
+	int inFront = 0, behind = 0;
+	for( int k = 0; k < n; ++k ) {
+		double x = 0.0, y = 0.0;
+		bool seen = camera->project( corner[k], x, y );
+		px[k] = x * width;
+		py[k] = y * height;
+		if( seen && std::isfinite( px[k] ) && std::isfinite( py[k] ) )
+			++inFront;
+		else if( !seen && std::isfinite( corner[k].length_squared() ) )
+			++behind;
+	}
+	if( behind == n )
+		return;
+
+	if( inFront == n ) {
+		// pixel i is at i + 0.5
+		double xmin = *std::min_element( px, px + n ) - RASTER_MARGIN - 0.5;
+		double xmax = *std::max_element( px, px + n ) + RASTER_MARGIN - 0.5;
+		double ymin = *std::min_element( py, py + n ) - RASTER_MARGIN - 0.5;
+		double ymax = *std::max_element( py, py + n ) + RASTER_MARGIN - 0.5;
+		c.x0 = (int)ceil( std::max( xmin, -1.0 ) );
+		c.y0 = (int)ceil( std::max( ymin, -1.0 ) );
+		c.x1 = (int)floor( std::min( xmax, (double)width ) );
+		c.y1 = (int)floor( std::min( ymax, (double)height ) );
+		c.x0 = std::max( c.x0, 0 );
+		c.y0 = std::max( c.y0, 0 );
+		c.x1 = std::min( c.x1, width - 1 );
+		c.y1 = std::min( c.y1, height - 1 );
+		if( c.x0 > c.x1 || c.y0 > c.y1 )
+			return;
+
+		// a triangle seen nearly edge on keeps just its rectangle
+		double area = n == 3 ? (px[1] - px[0]) * (py[2] - py[0]) - (py[1] - py[0]) * (px[2] - px[0]) : 0.0;
+		if( fabs( area ) >= 1.0 ) {
+			if( area < 0.0 ) {
+				std::swap( px[1], px[2] );
+				std::swap( py[1], py[2] );
+			}
+			c.triangle = true;
+			for( int e = 0; e < 3; ++e ) {
+				double dx = px[(e + 1) % 3] - px[e];
+				double dy = py[(e + 1) % 3] - py[e];
+				double length = sqrt( dx * dx + dy * dy );
+				c.edge[e][0] = -dy / length;
+				c.edge[e][1] = dx / length;
+				c.edge[e][2] = -(c.edge[e][0] * px[e] + c.edge[e][1] * py[e]);
+			}
+		}
+	}
+	covers.push_back( c );
+}
+
+// Find the first hits of the pixels of one tile.
+void PrimaryRaster::renderTile( int tile, std::deque<isect>& hits, vector<char>& found )
+{
+	int i0 = (tile % tilesWide) * RASTER_TILE, i1 = std::min( i0 + RASTER_TILE, width );
+	int j0 = (tile / tilesWide) * RASTER_TILE, j1 = std::min( j0 + RASTER_TILE, height );
+	int w = i1 - i0;
+	int n = w * (j1 - j0);
+
+	Camera *camera = scene->getCamera();
+	vector<ray> rays( n, ray( vec3f(0,0,0), vec3f(0,0,0) ) );
+	for( int j = j0; j < j1; ++j )
+		for( int i = i0; i < i1; ++i )
+			camera->rayThrough( (double(i) + 0.5)/double(width),
+								(double(j) + 0.5)/double(height), rays[(i - i0) + (j - j0) * w] );
+
+	vector<const Geometry*> first( n, (const Geometry*)NULL );
+	vector<double> best( n );
+	vector<char> tie( n, 0 );
+	isect cur;
+
+	const vector<int>& list = tiles[tile];
+	for( size_t l = 0; l < list.size(); ++l ) {
+		const Cover& c = covers[list[l]];
+		int y0 = std::max( c.y0, j0 ), y1 = std::min( c.y1 + 1, j1 );
+		int x0 = std::max( c.x0, i0 ), x1 = std::min( c.x1 + 1, i1 );
+		for( int j = y0; j < y1; ++j ) {
+			for( int i = x0; i < x1; ++i ) {
+				int k = (i - i0) + (j - j0) * w;
+				if( first[k] && c.near > best[k] + RASTER_TIE )
+					continue;
+				if( c.triangle ) {
+					double x = i + 0.5, y = j + 0.5;
+					if( c.edge[0][0] * x + c.edge[0][1] * y + c.edge[0][2] < -RASTER_MARGIN
+						|| c.edge[1][0] * x + c.edge[1][1] * y + c.edge[1][2] < -RASTER_MARGIN
+						|| c.edge[2][0] * x + c.edge[2][1] * y + c.edge[2][2] < -RASTER_MARGIN )
+						continue;
+				}
+				if( !scene->intersectObject( c.obj, rays[k], cur ) )
+					continue;
+
+				if( first[k] ) {
+					if( cur.t > best[k] + RASTER_TIE )
+						continue;
+					tie[k] = cur.t >= best[k] - RASTER_TIE;
+					if( cur.t >= best[k] )
+						continue;
+				}
+				first[k] = c.obj;
+				best[k] = cur.t;
+				hits[i + (size_t)j * width] = cur;
+			}
+		}
+	}
+
+	for( int j = j0; j < j1; ++j ) {
+		for( int i = i0; i < i1; ++i ) {
+			int k = (i - i0) + (j - j0) * w;
+			size_t idx = i + (size_t)j * width;
+			if( tie[k] ) {
+				found[idx] = scene->intersect( rays[k], cur );
+				if( found[idx] )
+					hits[idx] = cur;
+			} else {
+				found[idx] = first[k] != NULL;
+			}
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+// First hits found by rasterizing the scene instead of tracing a ray
+// through the octree for every pixel.
+//
+// Every object is projected onto the image once: a triangle onto the
+// triangle its corners make there, any other object onto the rectangle
+// around its box's corners, both grown by a pixel so that rounding never
+// loses a hit.  Objects without a box, or with a corner behind the eye,
+// cover the whole image.  The objects are sorted into square tiles of the
+// image, and each tile is a job on the thread pool which tries only the
+// objects over it on the rays through its pixels.  They go nearest box
+// first, and an object whose box is farther than what a pixel has already
+// hit isn't tried on that pixel at all.
+//
+// The hit tests are the scene's own, through Scene::intersectObject, so a
+// pixel gets the very hit Scene::intersect would give it, barycentric
+// interpolation and all.  A ray meeting two objects at all but the same
+// distance, where the octree's order decides, is left to Scene::intersect.
+
+#include <deque>
+#include <vector>
+
+#include "scene/ray.h"
+
+using std::vector;
+
+class Scene;
+class Geometry;
+class ThreadPool;
+
+class PrimaryRaster
+{
+public:
+	PrimaryRaster( Scene *scene, ThreadPool *pool );
+
+	// The first hit of the ray through the center of every pixel of a
+	// width x height image, row by row, as trace() finds it.  found says
+	// which of the rays hit anything.
+	void render( int width, int height, std::deque<isect>& hits, vector<char>& found );
+
+private:
+	// the pixels an object may be seen in
+	struct Cover {
+		const Geometry *obj;
+		double near;			// distance from the eye to its box
+		int x0, y0, x1, y1;		// the pixels of its rectangle, inclusive
+		bool triangle;			// and of those, the ones inside all of edge
+		double edge[3][3];		// a * x + b * y + c, distance from an edge in pixels
+	};
+
+	void cover( const Geometry *obj );
+	void renderTile( int tile, std::deque<isect>& hits, vector<char>& found );
+
+	Scene *scene;
+	ThreadPool *pool;
+	int width, height;
+	int tilesWide;
+
+	vector<Cover> covers;
+	vector< vector<int> > tiles;	// the covers over each tile, nearest first
+};
+
+#endif // __RASTER_H__
@@ -1,14 +1,179 @@
 // The main ray tracer.
 
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
 #include <Fl/fl_ask.h>
 
 #include "RayTracer.h"
 #include "scene/light.h"
 #include "scene/material.h"
 #include "scene/ray.h"
+#include "scene/ShadowMap.h"
 #include "fileio/read.h"
 #include "fileio/parse.h"
 #include "fileio/bitmap.h"
+#include "fileio/pfm.h"
+#include "ThreadPool.h"
+#include "Raster.h"
+
+// Number of rays traced for the current pixel, for the ray visualization.
+// Pixels may be traced on several threads at once, so each keeps its own.
+static thread_local vec3f n_ray;
+
+// per-thread scratch for a pixel's sample offsets
+static thread_local vector<double> pixel_samples;
+
+// The corner and edge samples of the adaptive mode, kept for the current
+// and the previous row of pixels so that a point shared by neighbouring
+// pixels (or sibling quads) is traced once.  Samples sit on a lattice of
+// n x n steps a pixel, n = 2^depth, and are looked up by their integer
+// lattice coordinates; the screen position is worked out from those, so
+// each point has one position however the quads reached it.
+class SampleCache
+{
+public:
+	struct Entry
+	{
+		vec3f col;
+		const SceneObject *obj;
+	};
+
+	SampleCache() : epoch( 0 ), row( -1 ), steps( 0 ) {}
+
+	// Start a pixel in row j of a frame with n lattice steps a pixel.  Rows
+	// other than the current and the next one start the cache over.
+	void beginPixel( unsigned int e, int j, int n )
+	{
+		if( e != epoch || n != steps || (j != row && j != row + 1) ) {
+			cur.clear();
+			prev.clear();
+			epoch = e;
+			steps = n;
+		}
+		else if( j == row + 1 ) {
+			prev.swap( cur );
+			cur.clear();
+		}
+		row = j;
+	}
+
+	int lattice() const { return steps; }
+
+	const Entry *find( long long x, long long y ) const
+	{
+		Key k = { x, y };
+		Row::const_iterator e = cur.find( k );
+		if( e != cur.end() )
+			return &e->second;
+		e = prev.find( k );
+		if( e != prev.end() )
+			return &e->second;
+		return NULL;
+	}
+
+	void insert( long long x, long long y, const vec3f& col, const SceneObject *obj )
+	{
+		Key k = { x, y };
+		Entry &e = cur[ k ];
+		e.col = col;
+		e.obj = obj;
+	}
+
+private:
+	struct Key
+	{
+		long long x, y;
+		bool operator==( const Key& k ) const { return x == k.x && y == k.y; }
+	};
+	struct KeyHash
+	{
+		size_t operator()( const Key& k ) const
+		{
+			unsigned long long h = (unsigned long long)k.x * 0x9E3779B97F4A7C15ULL ^ (unsigned long long)k.y;
+			return (size_t)(h ^ (h >> 29));
+		}
+	};
+	typedef std::unordered_map<Key, Entry, KeyHash> Row;
+
+	Row cur, prev;
+	unsigned int epoch;
+	int row, steps;
+};
+
+static thread_local SampleCache sample_cache;
+
+// The regular supersampling grid puts samples on both borders of every
+// pixel, so a pixel's right and top samples are its neighbours' left and
+// bottom ones.  SampleRows holds the grid rows under the current row of
+// pixels (sampleSize of them, the last one shared with the next row of
+// pixels) and fills each grid point the first time a pixel asks for it.
+class SampleRows
+{
+public:
+	SampleRows() : epoch( 0 ), row( -1 ), size( 0 ), cols( 0 ) {}
+
+	// Start pixel row j of a frame with n x n samples per pixel and cols
+	// grid points across.
+	void beginRow( unsigned int e, int j, int n, int c )
+	{
+		if( e != epoch || n != size || c != cols || (j != row && j != row + 1) ) {
+			epoch = e;
+			size = n;
+			cols = c;
+			colors.resize( (size_t)n * c );
+			done.assign( (size_t)n * c, 0 );
+		}
+		else if( j == row + 1 ) {
+			// the old top row is the new bottom one
+			size_t top = (size_t)(n - 1) * c;
+			std::copy( colors.begin() + top, colors.end(), colors.begin() );
+			std::copy( done.begin() + top, done.end(), done.begin() );
+			std::fill( done.begin() + c, done.end(), 0 );
+		}
+		row = j;
+	}
+
+	vec3f *at( int a, int k ) { return &colors[ (size_t)k * cols + a ]; }
+	bool filled( int a, int k ) const { return done[ (size_t)k * cols + a ] != 0; }
+	void fill( int a, int k ) { done[ (size_t)k * cols + a ] = 1; }
+
+private:
+	vector<vec3f> colors;
+	vector<unsigned char> done;
+	unsigned int epoch;
+	int row, size, cols;
+};
+
+static thread_local SampleRows sample_rows;
+
+// Every change that could alter a traced color gets a new epoch, which
+// empties the sample caches.  The counter is shared so that two tracers
+// never use the same number.
+static std::atomic<unsigned int> sample_epochs( 0 );
+
+void RayTracer::newSampleEpoch()
+{
+	sampleEpoch = ++sample_epochs;
+}
+
+// trace() through the adaptive sample cache, for the lattice point (x,y)
+vec3f RayTracer::cachedTrace( long long x, long long y, isect& i )
+{
+	const SampleCache::Entry *e = sample_cache.find( x, y );
+	if( e ) {
+		i.obj = e->obj;
+		return e->col;
+	}
+
+	double n = sample_cache.lattice();
+	vec3f col = trace( scene, double(x) / (n * buffer_width), double(y) / (n * buffer_height), i );
+	sample_cache.insert( x, y, col, i.obj );
+	return col;
+}
 
 // Trace a top-level ray through normalized window coordinates (x,y)
 // through the projection plane, and out into the scene.  All we do is
@@ -29,8 +194,121 @@ vec3f RayTracer::trace( Scene *scene, double x, double y, isect& i )
 	return traceRay( scene, r, vec3f(1.0,1.0,1.0), depth, i, stack).clamp();
 }
 
-void RayTracer::setSpotP(int p) { Light::setSpotP(p); }
-void RayTracer::setCutoff(float c) { Light::setCutoff(c); }
+enum GBufferState {
+	GBUFFER_EMPTY = 0,
+	GBUFFER_HIT,
+	GBUFFER_MISS
+};
+
+// trace() for the center of pixel (i,j) through the G-buffer.  The first
+// time, the pixel is traced as usual and its first hit kept; after that
+// the camera ray is made again and only the hit is shaded, so changes to
+// the lights, the materials, the depth or the threshold show up without
+// intersecting a single primary ray.  A pixel whose primary ray might not
+// be traced at all under the current depth and threshold is never kept.
+vec3f RayTracer::gbufferTrace( int i, int j, double x, double y )
+{
+	if( !gbufferUsable() )
+		return trace( scene, x, y );
+
+	size_t idx = i + (size_t)j * buffer_width;
+	if( gbufferState[idx] == GBUFFER_EMPTY ) {
+		isect hit;
+		vec3f col = trace( scene, x, y, hit );
+		gbuffer[idx] = hit;
+		gbufferState[idx] = hit.obj ? GBUFFER_HIT : GBUFFER_MISS;
+		return col;
+	}
+
+	ray r( vec3f(0,0,0), vec3f(0,0,0) );
+	scene->getCamera()->rayThrough( x, y, r );
+	n_ray += vec3f(0.02, 0.02, 0.02);
+	if( gbufferState[idx] == GBUFFER_MISS )
+		return background( r ).clamp();
+
+	vector<const SceneObject*> stack;
+	return shadeHit( scene, r, vec3f(1.0,1.0,1.0), depth, gbuffer[idx], stack ).clamp();
+}
+
+// trace() for the center of pixel (i,j) with the primary ray's hit found
+// through the frame's culled tiles.
+vec3f RayTracer::culledTrace( int i, int j, double x, double y )
+{
+	if( !gbufferUsable() )
+		return trace( scene, x, y );
+
+	ray r( vec3f(0,0,0), vec3f(0,0,0) );
+	scene->getCamera()->rayThrough( x, y, r );
+	n_ray += vec3f(0.02, 0.02, 0.02);
+	isect hit;
+	if( !tileCuller.intersect( i, j, r, hit ) )
+		return background( r ).clamp();
+
+	vector<const SceneObject*> stack;
+	return shadeHit( scene, r, vec3f(1.0,1.0,1.0), depth, hit, stack ).clamp();
+}
+
+void RayTracer::setGBuffer( bool keep )
+{
+	m_bGBuffer = keep;
+	validateGBuffer( (keep || m_bRaster) && buffer );
+}
+
+void RayTracer::setRasterPrimary( bool raster )
+{
+	m_bRaster = raster;
+	validateGBuffer( (m_bGBuffer || raster) && buffer );
+}
+
+// Rasterize the first hits of every pixel not in the G-buffer yet.
+void RayTracer::prepareGBuffer( ThreadPool *pool )
+{
+	if( !m_bRaster || !scene || mode != TRACE_NORMAL || ray_visual || !gbufferUsable()
+		|| std::find( gbufferState.begin(), gbufferState.end(), (char)GBUFFER_EMPTY ) == gbufferState.end() )
+		return;
+
+	PrimaryRaster raster( scene, pool );
+	vector<char> found;
+	raster.render( buffer_width, buffer_height, gbuffer, found );
+	for( size_t k = 0; k < found.size(); ++k )
+		gbufferState[k] = found[k] ? GBUFFER_HIT : GBUFFER_MISS;
+}
+
+void RayTracer::setTileCulling( bool cull )
+{
+	m_bCull = cull;
+	tileCuller.clear();
+}
+
+// Cull the tiles for the frame about to be traced, or drop them if they
+// won't be used.  They are made again every frame, as cheap next to it.
+void RayTracer::prepareTiles( ThreadPool *pool )
+{
+	tileCuller.clear();
+	if( m_bCull && scene && mode == TRACE_NORMAL && !ray_visual )
+		tileCuller.build( scene, buffer_width, buffer_height, pool );
+}
+
+// Empty the G-buffer if it was filled for another image size or view, and
+// size it for this frame, or free it if keep is false.
+void RayTracer::validateGBuffer( bool keep )
+{
+	size_t n = keep && scene ? (size_t)buffer_width * buffer_height : 0;
+	if( gbufferState.size() == n && gbufferWidth == buffer_width
+		&& ( !n || scene->getCamera()->sameView( gbufferCamera ) ) )
+		return;
+
+	gbuffer.clear();
+	gbuffer.resize( n );
+	gbufferState.assign( n, GBUFFER_EMPTY );
+	gbufferWidth = buffer_width;
+	if( n )
+		gbufferCamera = *scene->getCamera();
+}
+
+void RayTracer::setSpotP(int p) { Light::setSpotP(p); newSampleEpoch(); }
+void RayTracer::setCutoff(float c) { Light::setCutoff(c); newSampleEpoch(); }
+void RayTracer::setLightSamples(int n) { if(scene) scene->setLightSamples(n); newSampleEpoch(); }
 
 // Do recursive ray tracing!  You'll want to insert a lot of code here
 // (or places called from here) to handle reflection, refraction, etc etc.
@@ -46,126 +324,129 @@ vec3f RayTracer::traceRay( Scene *scene, const ray& r,
 	if( depth>=0
 		&& thresh[0] > threshold - RAY_EPSILON && thresh[1] > threshold - RAY_EPSILON && thresh[2] > threshold - RAY_EPSILON
 		&& scene->intersect( r, i ) ) {
-		// YOUR CODE HERE
-
-		// An intersection occured!  We've got work to do.  For now,
-		// this code gets the material for the surface that was intersected,
-		// and asks that material to provide a color for the ray.  
-
-		// This is a great place to insert code for recursive ray tracing.
-		// Instead of just returning the result of shade(), add some
-		// more steps: add in the contributions from reflected and refracted
-		// rays.
-		
-		const Material& m = i.getMaterial();
-		vec3f color = m.shade(scene, r, i);
-		//calculate the reflected ray
-		vec3f d = r.getDirection();
-		vec3f position = r.at(i.t);
-		vec3f direction = d - 2 * i.N * d.dot(i.N);
-		ray newray(position, direction);
-		if(!m.kr.iszero()) {
-			vec3f reflect = m.kr.multiply(traceRay(scene, newray, thresh.multiply(m.kr), depth-1, stack).clamp());
-			color += reflect;
-		}
+		return shadeHit( scene, r, thresh, depth, i, stack );
+	} else {
+		return background(r);
+	}
+}
 
-		//calculate the refracted ray
-		double ref_ratio;
-		double sin_ang = d.cross(i.N).length();
-		vec3f N = i.N;
-		//Decide going in or out
-		const SceneObject *mi = NULL, *mt = NULL;
-		int stack_idx = -1;
-		vector<const SceneObject*>::reverse_iterator itr;
-		//1 use the normal to decide whether to go in or out
-		//0: travel through, 1: in, 2: out
-		char travel = 0;
-		if(i.N.dot(d) <= -RAY_EPSILON) {
-			//from outer surface in
-			//test whether the object has two face
-			ray test_ray(r.at(i.t) + d * 2 * RAY_EPSILON, -d);
-			isect test_i;
-			if(i.obj->intersect(r, test_i) && test_i.N.dot(N) > -RAY_EPSILON) {
-				//has interior
-				travel = 1;
-			}
-		}
-		else {
-			travel = 2;
-		}
+// traceRay's color for r when its first hit i is already known
+vec3f RayTracer::shadeHit( Scene *scene, const ray& r, 
+	const vec3f& thresh, int depth, const isect& i, vector<const SceneObject*>& stack )
+{
+	// YOUR CODE HERE
 
-		if(travel == 1) {
-			if(!stack.empty()) {
-				mi = stack.back();
-			}
-			mt = i.obj;
-			stack.push_back(mt);
-		}
-		else if(travel == 2) {
-			//if it is in our stack, then we must pop it
-			for(itr = stack.rbegin(); itr != stack.rend(); ++itr) {
-				if(*itr == i.obj) {
-					mi = *itr;
-					vector<const SceneObject*>::iterator ii = itr.base() - 1;
-					stack_idx = ii - stack.begin();
-					stack.erase(ii);
-					break;
-				}
-			}
-			if(!stack.empty()) {
-				mt = stack.back();
-			}
-		}
+	// An intersection occured!  We've got work to do.  For now,
+	// this code gets the material for the surface that was intersected,
+	// and asks that material to provide a color for the ray.  
 
-		if(N.dot(d) >= RAY_EPSILON) {
-			N = -N;
-		}
-		
-		ref_ratio = (mi?(mi->getMaterial().index):1.0) / (mt?(mt->getMaterial().index):1.0);
-
-		if(!m.kt.iszero() && (ref_ratio < 1.0 + RAY_EPSILON || sin_ang < 1.0 / ref_ratio + RAY_EPSILON)) {
-			//No total internal reflection
-			//We do refraction now
-			double c = N.dot(-d);
-			direction = (ref_ratio * c - sqrt(1 - ref_ratio * ref_ratio * (1 - c * c))) * N + ref_ratio * d;
-			newray = ray(position, direction);
-			vec3f refraction = m.kt.multiply(traceRay(scene, newray, thresh.multiply(m.kt), depth-1, stack).clamp());
-			color += refraction;
+	// This is a great place to insert code for recursive ray tracing.
+	// Instead of just returning the result of shade(), add some
+	// more steps: add in the contributions from reflected and refracted
+	// rays.
+	
+	const Material& m = i.getMaterial();
+	vec3f color = m.shade(scene, r, i);
+	//calculate the reflected ray
+	vec3f d = r.getDirection();
+	vec3f position = r.at(i.t);
+	vec3f direction = d - 2 * i.N * d.dot(i.N);
+	ray newray(position, direction);
+	if(!m.kr.iszero()) {
+		vec3f reflect = m.kr.multiply(traceRay(scene, newray, thresh.multiply(m.kr), depth-1, stack).clamp());
+		color += reflect;
+	}
+
+	//calculate the refracted ray
+	double ref_ratio;
+	double sin_ang = d.cross(i.N).length();
+	vec3f N = i.N;
+	//Decide going in or out
+	const SceneObject *mi = NULL, *mt = NULL;
+	int stack_idx = -1;
+	vector<const SceneObject*>::reverse_iterator itr;
+	//1 use the normal to decide whether to go in or out
+	//0: travel through, 1: in, 2: out
+	char travel = 0;
+	if(i.N.dot(d) <= -RAY_EPSILON) {
+		//from outer surface in, if there is an inside to go into
+		if(i.obj->isClosed()) {
+			travel = 1;
 		}
+	}
+	else {
+		travel = 2;
+	}
 
-		if(travel == 1) {
-			stack.pop_back();
+	if(travel == 1) {
+		if(!stack.empty()) {
+			mi = stack.back();
 		}
-		else if(travel == 2) {
-			if(mi) {
-				stack.insert(stack.begin() + stack_idx, mi);
+		mt = i.obj;
+		stack.push_back(mt);
+	}
+	else if(travel == 2) {
+		//if it is in our stack, then we must pop it
+		for(itr = stack.rbegin(); itr != stack.rend(); ++itr) {
+			if(*itr == i.obj) {
+				mi = *itr;
+				vector<const SceneObject*>::iterator ii = itr.base() - 1;
+				stack_idx = ii - stack.begin();
+				stack.erase(ii);
+				break;
 			}
 		}
+		if(!stack.empty()) {
+			mt = stack.back();
+		}
+	}
+
+	if(N.dot(d) >= RAY_EPSILON) {
+		N = -N;
+	}
+	
+	ref_ratio = (mi?(mi->getMaterial().index):1.0) / (mt?(mt->getMaterial().index):1.0);
 
-		return color;
+	if(!m.kt.iszero() && (ref_ratio < 1.0 + RAY_EPSILON || sin_ang < 1.0 / ref_ratio + RAY_EPSILON)) {
+		//No total internal reflection
+		//We do refraction now
+		double c = N.dot(-d);
+		direction = (ref_ratio * c - sqrt(1 - ref_ratio * ref_ratio * (1 - c * c))) * N + ref_ratio * d;
+		newray = ray(position, direction);
+		vec3f refraction = m.kt.multiply(traceRay(scene, newray, thresh.multiply(m.kt), depth-1, stack).clamp());
+		color += refraction;
+	}
 
-	} else {
-		// No intersection.  This ray travels to infinity, so we color
-		// it according to the background color, which in this (simple) case
-		// is just black.
-		if(m_bBackground && bg) {
-			double u, v;
-			angleToSphere(r.getDirection(), u, v);
-			//Scale to [0, 1];
-			u /= 2 * M_PI;
-			v /= M_PI;
-			int tx = int(u * bg_width), ty = bg_height - int(v * bg_height);
-			return vec3f(bg[3 * (ty * bg_width + tx)] / 255.0, bg[3 * (ty * bg_width + tx) + 1] / 255.0, bg[3 * (ty * bg_width + tx) + 2] / 255.0);
-		}
-		else {
-			return vec3f( 0.0, 0.0, 0.0 );
+	if(travel == 1) {
+		stack.pop_back();
+	}
+	else if(travel == 2) {
+		if(mi) {
+			stack.insert(stack.begin() + stack_idx, mi);
 		}
 	}
+
+	return color;
+}
+
+// No intersection.  This ray travels to infinity, so we color it
+// according to the background image, or black.
+vec3f RayTracer::background( const ray& r )
+{
+	if(m_bBackground && envmap.loaded()) {
+		return envmap.lookup(r.getDirection());
+	}
+	else {
+		return vec3f( 0.0, 0.0, 0.0 );
+	}
 }
 
 RayTracer::RayTracer()
 {
 	buffer = NULL;
+	accum = NULL;
+	accumSq = NULL;
+	samples = NULL;
 	buffer_width = buffer_height = 256;
 	scene = NULL;
 	sampleSize = 1;
@@ -174,13 +455,25 @@ RayTracer::RayTracer()
 
 	m_bSceneLoaded = false;
 	m_bBackground = false;
-	bg = NULL;
+	shadowMapSize = 0;
+	builtShadowMaps = 0;
+	builtShadowCutoff = 0.0f;
+	m_bGBuffer = false;
+	m_bRaster = false;
+	m_bCull = false;
+	gbufferWidth = 0;
+	targetError = 0.01;
+	timeBudget = 0.0;
+	newSampleEpoch();
 }
 
 
 RayTracer::~RayTracer()
 {
 	delete [] buffer;
+	delete [] accum;
+	delete [] accumSq;
+	delete [] samples;
 	delete scene;
 }
 
@@ -203,13 +496,14 @@ bool RayTracer::sceneLoaded()
 
 void RayTracer::loadBGImage( char* fn ) {
 	unsigned char *data;
+	int bg_width, bg_height;
 	if( (data = readBMP(fn, bg_width, bg_height)) == NULL) {
 		fl_alert( "Can't load bitmap file " );
 	}
-	if(bg) {
-		delete [] bg;
-	}
-	bg = data;
+	// the bytes are only needed to fill the cube map
+	envmap.build(data, bg_width, bg_height);
+	delete [] data;
+	newSampleEpoch();
 }
 
 bool RayTracer::loadScene( char* fn )
@@ -230,11 +524,13 @@ bool RayTracer::loadScene( char* fn )
 	buffer_width = 256;
 	buffer_height = (int)(buffer_width / scene->getCamera()->getAspectRatio() + 0.5);
 
-	bufferSize = buffer_width * buffer_height * 3;
-	buffer = new unsigned char[ bufferSize ];
+	allocBuffers();
 	
 	// separate objects into bounded and unbounded
 	scene->initScene();
+	builtShadowMaps = 0;
+	validateGBuffer( false );
+	tileCuller.clear();
 	
 	// Add any specialized scene loading code here
 	//add a spot light to scene
@@ -243,23 +539,22 @@ bool RayTracer::loadScene( char* fn )
 	return true;
 }
 
-void RayTracer::angleToSphere(vec3f di, double& u, double &v) const {
-	vec3f uu, vv, ll;
-	scene->getCamera()->getUVL(uu, vv, ll);
-	vec3f dd;
-	dd[0] = ll.dot(di);
-	dd[1] = uu.dot(di);
-	dd[2] = vv.dot(di);
-	u = atan2(dd[1], dd[0]) + M_PI;
-	v = acos(dd[2]);
-}
-
 void RayTracer::setMode(enum TraceMode m) {
 	mode = m;
+	newSampleEpoch();
 }
 
 void RayTracer::setSampleSize(int size) {
 	sampleSize = size;
+	newSampleEpoch();
+}
+
+void RayTracer::setSamplePattern(enum SamplePattern p) {
+	sampler.setPattern(p);
+}
+
+void RayTracer::setScramble(bool s) {
+	sampler.setScramble(s);
 }
 
 void RayTracer::setDisp(bool visual) {
@@ -270,23 +565,102 @@ void RayTracer::setAccel(bool acc) {
 	scene->setBSP(acc);
 }
 
-void RayTracer::traceSetup( int w, int h, int d, float scale, float thresh )
+void RayTracer::traceSetup( int w, int h, int d, float scale, float thresh, bool streamed )
 {
-	if( buffer_width != w || buffer_height != h )
+	if( streamed )
 	{
+		// traceStream only ever holds one band of scanlines, so drop the
+		// full frame buffers instead of allocating them for nothing.
 		buffer_width = w;
 		buffer_height = h;
 
-		bufferSize = buffer_width * buffer_height * 3;
+		bufferSize = 0;
 		delete [] buffer;
-		buffer = new unsigned char[ bufferSize ];
+		delete [] accum;
+		delete [] accumSq;
+		delete [] samples;
+		buffer = NULL;
+		accum = NULL;
+		accumSq = NULL;
+		samples = NULL;
 	}
-	memset( buffer, 0, w*h*3 );
+	else if( buffer_width != w || buffer_height != h || !buffer || !accum )
+	{
+		buffer_width = w;
+		buffer_height = h;
+
+		allocBuffers();
+	}
+	clearAccumulation();
+	newSampleEpoch();
+	frameStart = std::chrono::steady_clock::now();
 	depth = d;
 	threshold = thresh;
 	if(scene) {
 		scene->setScale(scale);
+		envmap.setBasis(scene->getCamera());
+	}
+	validateGBuffer( (m_bGBuffer || m_bRaster) && !streamed );
+	tileCuller.clear();
+}
+
+// Trace every line of the image on the worker threads of pool, a band of
+// neighbouring scanlines per job.
+void RayTracer::traceParallel( ThreadPool *pool, int band )
+{
+	if( !scene )
+		return;
+
+	prepareShadowMaps( pool );
+	prepareGBuffer( pool );
+	prepareTiles( pool );
+
+	if( !pool || pool->size() <= 1 ) {
+		traceLines( 0, buffer_height );
+		return;
+	}
+
+	int njobs = (buffer_height + band - 1) / band;
+	pool->run( njobs, [this, band]( int job ) {
+		traceLines( job * band, job * band + band );
+	} );
+}
+
+// Give every light a shadow map of shadowMapSize, or take them away, if
+// that or the spot light cone has changed since they were made.  Each row
+// of every map is one job for the pool.
+void RayTracer::prepareShadowMaps( ThreadPool *pool )
+{
+	if( !scene )
+		return;
+	if( shadowMapSize == builtShadowMaps
+		&& ( !shadowMapSize || Light::getCutoff() == builtShadowCutoff ) )
+		return;
+
+	vector<ShadowMap*> maps;
+	vector<int> first;
+	int rows = 0;
+	for( Scene::cliter l = scene->beginLights(); l != scene->endLights(); ++l ) {
+		(*l)->setShadowMap( shadowMapSize > 0 ? (*l)->makeShadowMap( shadowMapSize ) : NULL );
+		if( (*l)->getShadowMap() ) {
+			maps.push_back( (*l)->getShadowMap() );
+			first.push_back( rows );
+			rows += maps.back()->rows();
+		}
 	}
+
+	std::function<void(int)> job = [this, &maps, &first]( int row ) {
+		int m = (int)(std::upper_bound( first.begin(), first.end(), row ) - first.begin()) - 1;
+		maps[m]->renderRow( scene, row - first[m] );
+	};
+	if( pool && pool->size() > 1 )
+		pool->run( rows, job );
+	else
+		for( int row = 0; row < rows; ++row )
+			job( row );
+
+	builtShadowMaps = shadowMapSize;
+	builtShadowCutoff = Light::getCutoff();
 }
 
 void RayTracer::traceLines( int start, int stop )
@@ -303,70 +677,497 @@ void RayTracer::traceLines( int start, int stop )
 			tracePixel(i,j);
 }
 
-void RayTracer::tracePixel( int i, int j )
+// Render the whole image band by band, appending every finished band of
+// scanlines to the bitmap fn.  Only one band is held in memory at a time,
+// so the image size is limited by the disk rather than by the address space.
+// The scanlines of each band are split over the worker threads of pool.
+// traceSetup must have been called with streamed = true.
+bool RayTracer::traceStream( ThreadPool *pool, char *fn, int band )
 {
-	vec3f col;
+	if( !scene )
+		return false;
 
-	n_ray = vec3f(0.0, 0.0, 0.0);
+	if( band < 1 )
+		band = 1;
+	if( band > buffer_height )
+		band = buffer_height;
+
+	FILE *outFile = beginBMP( fn, buffer_width, buffer_height );
+	if( !outFile )
+		return false;
+
+	prepareShadowMaps( pool );
+	prepareTiles( pool );
+
+	unsigned char *lines = new unsigned char[ (size_t)buffer_width * band * 3 ];
+	int threads = pool && pool->size() > 1 ? pool->size() : 1;
 
+	for( int start = 0; start < buffer_height; start += band ) {
+		int stop = min( start + band, buffer_height );
+		// each job takes a run of neighbouring scanlines, which keeps the
+		// sample caches' rows
+		int rows = (stop - start + threads - 1) / threads;
+		int njobs = (stop - start + rows - 1) / rows;
+		auto job = [this, lines, start, stop, rows]( int k ) {
+			int last = min( start + (k + 1) * rows, stop );
+			for( int j = start + k * rows; j < last; ++j ) {
+				unsigned char *pixel = lines + (size_t)(j - start) * buffer_width * 3;
+				for( int i = 0; i < buffer_width; ++i, pixel += 3 ) {
+					vec3f col = samplePixel( i, j );
+					pixel[0] = (int)( 255.0 * col[0]);
+					pixel[1] = (int)( 255.0 * col[1]);
+					pixel[2] = (int)( 255.0 * col[2]);
+				}
+			}
+		};
+		if( threads > 1 )
+			pool->run( njobs, job );
+		else
+			for( int k = 0; k < njobs; ++k )
+				job( k );
+		writeBMPLines( outFile, buffer_width, stop - start, lines );
+	}
+
+	delete [] lines;
+	endBMP( outFile );
+
+	return true;
+}
+
+void RayTracer::tracePixel( int i, int j )
+{
 	if( !scene )
 		return;
 
-	if(mode == TRACE_NORMAL || ( (mode == TRACE_ANTIALIAS_NORMAL || mode == TRACE_ADAPTIVE_ANTIALIAS) && sampleSize == 1)) {
+	if( mode == TRACE_VARIANCE ) {
+		// every sample goes in on its own so that the spread can be measured
+		int n = sampleSize * sampleSize < 2 ? 2 : sampleSize * sampleSize;
+		for( int k = 0; k < n; ++k )
+			accumulate( i, j, samplePixel( i, j ) );
+	}
+	else
+		accumulate( i, j, samplePixel( i, j ) );
+}
+
+// Add one more estimate of pixel (i,j) to the running sum and refresh the
+// 8 bit display pixel from the new average.  Successive passes over the
+// image therefore refine it instead of replacing it.
+void RayTracer::accumulate( int i, int j, const vec3f& col )
+{
+	size_t idx = i + (size_t)j * buffer_width;
+	float *sum = accum + idx * 3;
+	int n = ++samples[idx];
+
+	sum[0] += (float)col[0];
+	sum[1] += (float)col[1];
+	sum[2] += (float)col[2];
+
+	float *sq = accumSq + idx * 3;
+	sq[0] += (float)(col[0] * col[0]);
+	sq[1] += (float)(col[1] * col[1]);
+	sq[2] += (float)(col[2] * col[2]);
+
+	// a lone sample is quantized from the double color itself, so single
+	// pass renders come out exactly as before
+	unsigned char *pixel = buffer + idx * 3;
+	if( n == 1 ) {
+		pixel[0] = (int)( 255.0 * col[0]);
+		pixel[1] = (int)( 255.0 * col[1]);
+		pixel[2] = (int)( 255.0 * col[2]);
+	}
+	else {
+		pixel[0] = (int)( 255.0 * sum[0] / n);
+		pixel[1] = (int)( 255.0 * sum[1] / n);
+		pixel[2] = (int)( 255.0 * sum[2] / n);
+	}
+}
+
+// Forget every sample accumulated so far and blank the display buffer.
+void RayTracer::clearAccumulation()
+{
+	if( buffer )
+		memset( buffer, 0, bufferSize );
+	if( accum )
+		memset( accum, 0, (size_t)buffer_width * buffer_height * 3 * sizeof(float) );
+	if( accumSq )
+		memset( accumSq, 0, (size_t)buffer_width * buffer_height * 3 * sizeof(float) );
+	if( samples )
+		memset( samples, 0, (size_t)buffer_width * buffer_height * sizeof(int) );
+}
+
+int RayTracer::getSampleCount( int i, int j ) const
+{
+	return samples ? samples[i + (size_t)j * buffer_width] : 0;
+}
+
+// Estimated standard error of pixel (i,j)'s mean, from the spread of its
+// samples: the worst of the three channels.
+double RayTracer::pixelError( int i, int j ) const
+{
+	size_t idx = i + (size_t)j * buffer_width;
+	int n = samples ? samples[idx] : 0;
+	if( n < 2 )
+		return 1.0;
+
+	double worst = 0.0;
+	for( int c = 0; c < 3; ++c ) {
+		double mean = accum[idx * 3 + c] / n;
+		double var = (accumSq[idx * 3 + c] / n - mean * mean) * n / (n - 1);
+		if( var > worst )
+			worst = var;
+	}
+	return sqrt( worst / n );
+}
+
+void RayTracer::setVarianceTarget( double error, double seconds )
+{
+	targetError = error;
+	timeBudget = seconds;
+}
+
+// Whether the time budget given to setVarianceTarget has run out since
+// traceSetup started the frame.
+bool RayTracer::budgetSpent() const
+{
+	return timeBudget > 0.0 &&
+		std::chrono::duration<double>( std::chrono::steady_clock::now() - frameStart ).count() >= timeBudget;
+}
+
+// One round of TRACE_VARIANCE refinement.  The pixels whose error is
+// above the target are ranked, and the worst eighth of the image (or all
+// of them, if fewer) doubles its sample count, up to 16 more samples per
+// pixel per round.  Returns the number of pixels refined, 0 once the
+// image has converged or the budget is spent.
+int RayTracer::varianceRound( ThreadPool *pool )
+{
+	if( !scene || !samples || budgetSpent() )
+		return 0;
+
+	int maxSamples = 64 * (sampleSize * sampleSize < 2 ? 2 : sampleSize * sampleSize);
+
+	vector< std::pair<double, int> > todo;
+	for( int j = 0; j < buffer_height; ++j ) {
+		for( int i = 0; i < buffer_width; ++i ) {
+			int idx = i + j * buffer_width;
+			if( samples[idx] >= maxSamples )
+				continue;
+			double err = pixelError( i, j );
+			if( err > targetError )
+				todo.push_back( std::make_pair( err, idx ) );
+		}
+	}
+	if( todo.empty() )
+		return 0;
+
+	size_t count = (size_t)buffer_width * buffer_height / 8;
+	if( count < 1 )
+		count = 1;
+	if( count < todo.size() ) {
+		std::nth_element( todo.begin(), todo.begin() + count, todo.end(),
+						  std::greater< std::pair<double, int> >() );
+		todo.resize( count );
+	}
+
+	const int chunk = 64;
+	int njobs = (int)((todo.size() + chunk - 1) / chunk);
+	auto job = [this, &todo, chunk, maxSamples]( int k ) {
+		if( budgetSpent() )
+			return;
+		size_t end = std::min( todo.size(), (size_t)(k + 1) * chunk );
+		for( size_t p = (size_t)k * chunk; p < end; ++p ) {
+			int idx = todo[p].second;
+			int i = idx % buffer_width, j = idx / buffer_width;
+			int extra = std::min( std::min( samples[idx], 16 ), maxSamples - samples[idx] );
+			for( int s = 0; s < extra; ++s )
+				accumulate( i, j, samplePixel( i, j ) );
+		}
+	};
+
+	if( pool && pool->size() > 1 )
+		pool->run( njobs, job );
+	else
+		for( int k = 0; k < njobs; ++k )
+			job( k );
+
+	return (int)todo.size();
+}
+
+// One stage of traceDeadline, which gives every pixel one new sample.
+// With block > 1 only the centre of each block x block square is traced
+// and its color fills the square.  Otherwise pass 0 traces the pixel
+// centres and later passes jitter within the pixel.  Returns false if the
+// deadline passed before every pixel was done.
+bool RayTracer::deadlineStage( ThreadPool *pool, int block, int pass,
+							   const std::chrono::steady_clock::time_point& deadline )
+{
+	std::atomic<bool> late( false );
+	int step = block > 1 ? block : 1;
+	int band = block > 1 ? block : 8;
+	int njobs = (buffer_height + band - 1) / band;
+
+	auto job = [&]( int k ) {
+		int stop = std::min( buffer_height, (k + 1) * band );
+		for( int j = k * band; j < stop; j += step ) {
+			if( late || std::chrono::steady_clock::now() >= deadline ) {
+				late = true;
+				return;
+			}
+			for( int i = 0; i < buffer_width; i += step ) {
+				double x, y;
+				if( block > 1 ) {
+					x = std::min( i + 0.5 * block, (double)buffer_width ) / buffer_width;
+					y = std::min( j + 0.5 * block, (double)buffer_height ) / buffer_height;
+				}
+				else if( pass == 0 ) {
+					x = (i + 0.5) / buffer_width;
+					y = (j + 0.5) / buffer_height;
+				}
+				else {
+					double xy[2];
+					sampler.pixelSamples( i, j, pass, 1, xy );
+					x = (i + xy[0]) / buffer_width;
+					y = (j + xy[1]) / buffer_height;
+				}
+
+				vec3f col = trace( scene, x, y );
+				for( int jj = j; jj < std::min( j + step, buffer_height ); ++jj )
+					for( int ii = i; ii < std::min( i + step, buffer_width ); ++ii )
+						accumulate( ii, jj, col );
+			}
+		}
+	};
+
+	if( pool && pool->size() > 1 )
+		pool->run( njobs, job );
+	else
+		for( int k = 0; k < njobs; ++k )
+			job( k );
+
+	return !late;
+}
+
+// Render within a wall clock deadline, improving the image in stages:
+// 8x8, 4x4 and 2x2 pixel blocks without reflections or refractions, full
+// resolution at each recursion depth up to the one given to traceSetup,
+// then jittered passes that add a sample per pixel.  Each of the first
+// stages replaces the image, and one that runs out of time is thrown away
+// in favour of the last complete one.  A sample pass cut short leaves some
+// pixels with one sample more than the rest, which is still a finished
+// image.  The first stage always runs to the end.  progress is called
+// after every complete stage and may return false to stop early.  Returns
+// the number of stages completed.
+int RayTracer::traceDeadline( ThreadPool *pool, double seconds, const std::function<bool()>& progress )
+{
+	if( !scene || !samples )
+		return 0;
+
+	prepareShadowMaps( pool );
+
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+		+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>( seconds ) );
+
+	size_t pixels = (size_t)buffer_width * buffer_height;
+	vector<unsigned char> bestBuffer( bufferSize );
+	vector<float> bestAccum( pixels * 3 ), bestSq( pixels * 3 );
+	vector<int> bestSamples( pixels );
+
+	int fullDepth = depth;
+	int stages = 0;
+	bool stopped = false;
+
+	const int blocks[] = { 8, 4, 2 };
+	int previews = 3 + fullDepth + 1;
+	for( int s = 0; s < previews && !stopped; ++s ) {
+		int block = s < 3 ? blocks[s] : 1;
+		depth = s < 3 ? 0 : s - 3;
+
+		clearAccumulation();
+		bool first = s == 0;
+		if( !deadlineStage( pool, block, 0, first ? std::chrono::steady_clock::time_point::max() : deadline ) ) {
+			memcpy( buffer, &bestBuffer[0], bufferSize );
+			memcpy( accum, &bestAccum[0], pixels * 3 * sizeof(float) );
+			memcpy( accumSq, &bestSq[0], pixels * 3 * sizeof(float) );
+			memcpy( samples, &bestSamples[0], pixels * sizeof(int) );
+			stopped = true;
+			break;
+		}
+
+		++stages;
+		if( s + 1 < previews ) {
+			memcpy( &bestBuffer[0], buffer, bufferSize );
+			memcpy( &bestAccum[0], accum, pixels * 3 * sizeof(float) );
+			memcpy( &bestSq[0], accumSq, pixels * 3 * sizeof(float) );
+			memcpy( &bestSamples[0], samples, pixels * sizeof(int) );
+		}
+		if( progress && !progress() )
+			stopped = true;
+	}
+
+	for( int pass = 1; !stopped; ++pass ) {
+		stopped = !deadlineStage( pool, 1, pass, deadline );
+		if( !stopped )
+			++stages;
+		if( progress && !progress() )
+			stopped = true;
+	}
+
+	depth = fullDepth;
+	return stages;
+}
+
+// Render the whole frame in TRACE_VARIANCE mode: a first pass of
+// sampleSize^2 samples per pixel, then refinement rounds until the error
+// target or the time budget is reached.  Returns the number of samples
+// in the image.
+long long RayTracer::traceVariance( ThreadPool *pool )
+{
+	if( !scene || !samples )
+		return 0;
+
+	traceParallel( pool );
+	while( varianceRound( pool ) > 0 )
+		;
+
+	long long total = 0;
+	for( size_t p = 0; p < (size_t)buffer_width * buffer_height; ++p )
+		total += samples[p];
+	return total;
+}
+
+// (Re)allocate the display buffer and the float accumulation buffer for
+// the current buffer_width x buffer_height.
+void RayTracer::allocBuffers()
+{
+	size_t pixels = (size_t)buffer_width * buffer_height;
+
+	bufferSize = pixels * 3;
+	delete [] buffer;
+	delete [] accum;
+	delete [] accumSq;
+	delete [] samples;
+	buffer = new unsigned char[ bufferSize ];
+	accum = new float[ pixels * 3 ];
+	accumSq = new float[ pixels * 3 ];
+	samples = new int[ pixels ];
+	clearAccumulation();
+}
+
+// Write the averaged accumulation buffer as a floating point PFM image.
+bool RayTracer::saveHDR( char *fn )
+{
+	if( !accum )
+		return false;
+
+	FILE *outFile = beginPFM( fn, buffer_width, buffer_height );
+	if( !outFile )
+		return false;
+
+	float *line = new float[ (size_t)buffer_width * 3 ];
+	for( int j = 0; j < buffer_height; ++j ) {
+		for( int i = 0; i < buffer_width; ++i ) {
+			size_t idx = i + (size_t)j * buffer_width;
+			int n = samples[idx] ? samples[idx] : 1;
+			for( int c = 0; c < 3; ++c )
+				line[i * 3 + c] = accum[idx * 3 + c] / n;
+		}
+		writePFMLines( outFile, buffer_width, 1, line );
+	}
+	delete [] line;
+	endPFM( outFile );
+
+	return true;
+}
+
+// Compute the final color of pixel (i,j) with the current trace mode.
+vec3f RayTracer::samplePixel( int i, int j )
+{
+	vec3f col;
+
+	n_ray = vec3f(0.0, 0.0, 0.0);
+
+	if(mode == TRACE_NORMAL || mode == TRACE_DEADLINE || ( (mode == TRACE_ANTIALIAS_NORMAL || mode == TRACE_ADAPTIVE_ANTIALIAS) && sampleSize == 1)) {
 
 		double x = (double(i) + 0.5)/double(buffer_width);
 		double y = (double(j) + 0.5)/double(buffer_height);
 
-		col = trace( scene,x,y );
+		if( mode == TRACE_NORMAL && !ray_visual && !gbufferState.empty() )
+			col = gbufferTrace( i, j, x, y );
+		else if( mode == TRACE_NORMAL && !ray_visual && tileCuller.ready() )
+			col = culledTrace( i, j, x, y );
+		else
+			col = trace( scene,x,y );
+	}
+	else if(mode == TRACE_VARIANCE) {
+		// a single sample, carrying on the pixel's sequence
+		double xy[2];
+		sampler.pixelSamples(i, j, samples ? samples[i + (size_t)j * buffer_width] : 0, 1, xy);
+		col = trace( scene, (double(i) + xy[0]) / double(buffer_width),
+					(double(j) + xy[1]) / double(buffer_height) );
+	}
+	else if(mode == TRACE_JITTER || (mode == TRACE_ANTIALIAS_NORMAL && sampler.getPattern() != SAMPLE_DEFAULT)) {
+		col = vec3f(0.0, 0.0, 0.0);
+		int m = sampleSize * sampleSize;
+		int pass = samples ? samples[i + (size_t)j * buffer_width] : 0;
+		pixel_samples.resize(2 * m);
+		sampler.pixelSamples(i, j, pass, sampleSize, &pixel_samples[0]);
+		for(int n = 0; n < m; n++) {
+			double x = (double(i) + pixel_samples[2 * n]) / double(buffer_width);
+			double y = (double(j) + pixel_samples[2 * n + 1]) / double(buffer_height);
+			col += trace( scene, x, y);
+		}
+		col /= 1.0 * m;
 	}
 	else if(mode == TRACE_ANTIALIAS_NORMAL) {
+		// grid point (a, k) of the row is sample (a % (size-1), k) of pixel
+		// a / (size-1), so the shared border samples are traced once
 		col = vec3f(0.0, 0.0, 0.0);
-		double interval = 1.0 / double(sampleSize - 1);
+		int steps = sampleSize - 1;
+		double interval = 1.0 / double(steps);
+		sample_rows.beginRow(sampleEpoch, j, sampleSize, buffer_width * steps + 1);
 		int m, n;
 		for(m = 0; m < sampleSize; m++) {
+			int a = i * steps + m;
 			for(n = 0; n < sampleSize; n++) {
-				double x = (double(i) + m * interval)/double(buffer_width);
-				double y = (double(j) + n * interval)/double(buffer_height);
-				col += trace( scene, x, y);
+				vec3f *s = sample_rows.at(a, n);
+				if(!sample_rows.filled(a, n)) {
+					double x = (double(a / steps) + (a % steps) * interval)/double(buffer_width);
+					double y = (double(j) + n * interval)/double(buffer_height);
+					*s = trace( scene, x, y);
+					sample_rows.fill(a, n);
+				}
+				col += *s;
 			}
 		}
 		col /= 1.0 * sampleSize * sampleSize;
 	}
 	else if(mode == TRACE_ADAPTIVE_ANTIALIAS) {
-		double x = double(i)/double(buffer_width);
-		double y = double(j)/double(buffer_height);
+		// a pixel is n x n steps of the sample lattice, so that every
+		// subdivision point falls on it
+		int n = 1 << sampleSize;
+		long long x = (long long)i * n;
+		long long y = (long long)j * n;
 		vec3f lb, rb, lt, rt;
 		isect lb_i, rb_i, lt_i, rt_i;
-		lb = trace(scene, x, y, lb_i);
-		rb = trace(scene, x + 1.0/double(buffer_width), y, rb_i);
-		rt = trace(scene, x + 1.0/double(buffer_width), y + 1.0/double(buffer_height), rt_i);
-		lt = trace(scene, x, y + 1.0/double(buffer_height), lt_i);
-		col = adaptiveSample(x, y, 1.0/double(buffer_width), 1.0/double(buffer_width), sampleSize,
+		sample_cache.beginPixel(sampleEpoch, j, n);
+		lb = cachedTrace(x, y, lb_i);
+		rb = cachedTrace(x + n, y, rb_i);
+		rt = cachedTrace(x + n, y + n, rt_i);
+		lt = cachedTrace(x, y + n, lt_i);
+		col = adaptiveSample(x, y, n, sampleSize,
 							lb, lb_i, rb, rb_i, rt, rt_i, lt, lt_i);
 	}
-	else if(mode == TRACE_JITTER) {
-		col = vec3f(0.0, 0.0, 0.0);
-		int m = sampleSize * sampleSize;
-		for(int n = 0; n < m; n++) {
-			double x = (double(i) + 1.0 * rand() / RAND_MAX) / double(buffer_width);
-			double y = (double(j) + 1.0 * rand() / RAND_MAX) / double(buffer_height);
-			col += trace( scene, x, y);
-		}
-		col /= 1.0 * m;
-	}
-
-	unsigned char *pixel = buffer + ( i + j * buffer_width ) * 3;
 
 	if(ray_visual) {
 		col = n_ray.clamp();
 	}
 
-	pixel[0] = (int)( 255.0 * col[0]);
-	pixel[1] = (int)( 255.0 * col[1]);
-	pixel[2] = (int)( 255.0 * col[2]);
+	return col;
 }
 
-vec3f RayTracer::adaptiveSample( double x, double y, double w, double h, int depth, 
+// The quad of size x size lattice steps with its lower left corner at
+// (x,y), split into four while its corners disagree and depth allows.
+vec3f RayTracer::adaptiveSample( long long x, long long y, int size, int depth, 
 							vec3f& LB_col, isect& LB, vec3f& RB_col, isect& RB,
 							vec3f& RT_col, isect& RT, vec3f& LT_col, isect& LT)
 {
@@ -380,18 +1181,17 @@ vec3f RayTracer::adaptiveSample( double x, double y, double w, double h, int dep
 	else {
 		vec3f center, t, b, l, r;
 		isect c_i, t_i, b_i, l_i, r_i;
-		double hw = w / 2;
-		double hh = h / 2;
-		center = trace(scene, x + hw, y + hh, c_i);
-		b = trace(scene, x + hw, y, b_i);
-		t = trace(scene, x + hw, y + h, t_i);
-		l = trace(scene, x, y + hh, l_i);
-		r = trace(scene, x + w, y + hh, r_i);
-
-		return (adaptiveSample(x, y, hw, hh, depth - 1, LB_col, LB, b, b_i, center, c_i, l, l_i)
-				+ adaptiveSample(x + hw, y, hw, hh, depth - 1, b, b_i, RB_col, RB, r, r_i, center, c_i)
-				+ adaptiveSample(x, y + hh, hw, hh, depth - 1, l, l_i, center, c_i, t, t_i, LT_col, LT)
-				+ adaptiveSample(x + hw, y + hh, hw, hh, depth - 1, center, c_i, r, r_i, RT_col, RT, t, t_i)
+		int half = size / 2;
+		center = cachedTrace(x + half, y + half, c_i);
+		b = cachedTrace(x + half, y, b_i);
+		t = cachedTrace(x + half, y + size, t_i);
+		l = cachedTrace(x, y + half, l_i);
+		r = cachedTrace(x + size, y + half, r_i);
+
+		return (adaptiveSample(x, y, half, depth - 1, LB_col, LB, b, b_i, center, c_i, l, l_i)
+				+ adaptiveSample(x + half, y, half, depth - 1, b, b_i, RB_col, RB, r, r_i, center, c_i)
+				+ adaptiveSample(x, y + half, half, depth - 1, l, l_i, center, c_i, t, t_i, LT_col, LT)
+				+ adaptiveSample(x + half, y + half, half, depth - 1, center, c_i, r, r_i, RT_col, RT, t, t_i)
 				) / 4;
 	}
 }
@@ -5,15 +5,25 @@
 
 #include "scene/scene.h"
 #include "scene/ray.h"
+#include "scene/envmap.h"
+#include "Sampler.h"
+#include "TileCull.h"
 #include <vector>
+#include <deque>
+#include <chrono>
+#include <functional>
 
 using std::vector;
 
+class ThreadPool;
+
 enum TraceMode {
 	TRACE_NORMAL = 0,
 	TRACE_ANTIALIAS_NORMAL,
 	TRACE_JITTER,
 	TRACE_ADAPTIVE_ANTIALIAS,
+	TRACE_VARIANCE,
+	TRACE_DEADLINE,
 	NUM_TRACE_MODE
 };
 
@@ -30,14 +40,30 @@ public:
     vec3f trace( Scene *scene, double x, double y, isect& i );
 	vec3f traceRay( Scene *scene, const ray& r, const vec3f& thresh, int depth, vector<const SceneObject*>& stack );
 	vec3f traceRay( Scene *scene, const ray& r, const vec3f& thresh, int depth, isect& i, vector<const SceneObject*>& stack );
+	// traceRay's color for r when its first hit i is already known
+	vec3f shadeHit( Scene *scene, const ray& r, const vec3f& thresh, int depth, const isect& i, vector<const SceneObject*>& stack );
+	vec3f background( const ray& r );
 
 	void getBuffer( unsigned char *&buf, int &w, int &h );
 	double aspectRatio();
-	void traceSetup( int w, int h, int d, float scale, float tr);
+	void traceSetup( int w, int h, int d, float scale, float tr, bool streamed = false );
 	void traceLines( int start = 0, int stop = 10000000 );
+	void traceParallel( ThreadPool *pool, int band = 8 );
+	bool traceStream( ThreadPool *pool, char *fn, int band = 16 );
+	long long traceVariance( ThreadPool *pool );
+	int varianceRound( ThreadPool *pool );
+	int traceDeadline( ThreadPool *pool, double seconds,
+					   const std::function<bool()>& progress = std::function<bool()>() );
 	void tracePixel( int i, int j );
+	vec3f samplePixel( int i, int j );
+
+	void accumulate( int i, int j, const vec3f& col );
+	void clearAccumulation();
+	int getSampleCount( int i, int j ) const;
+	double pixelError( int i, int j ) const;
+	bool saveHDR( char *fn );
 
-	vec3f adaptiveSample( double x, double y, double w, double h, int depth, 
+	vec3f adaptiveSample( long long x, long long y, int size, int depth, 
 							vec3f& LB_col, isect& LB, vec3f& RB_col, isect& RB,
 							vec3f& RT_col, isect& RT, vec3f& LT_col, isect& LT);
 
@@ -47,27 +73,72 @@ public:
 	bool loadScene( char* fn );
 
 	void setMode(enum TraceMode m);
+	enum TraceMode getMode() const { return mode; }
 	void setSampleSize(int size);
+	void setSamplePattern(enum SamplePattern p);
+	void setScramble(bool s);
+	void setVarianceTarget(double error, double seconds);
+	bool budgetSpent() const;
 	void setDisp(bool visual);
 	void setAccel(bool acc);
 
 	void setSpotP(int p);
 	void setCutoff(float c);
+	// shade with n lights picked at random by importance, 0 for all of them
+	void setLightSamples(int n);
+	// approximate every light's shadows with size x size depth maps, built
+	// on the thread pool when a frame starts; 0 traces them exactly
+	void setShadowMaps(int size) { shadowMapSize = size; newSampleEpoch(); }
+	void prepareShadowMaps(ThreadPool *pool);
+	// In TRACE_NORMAL keep every pixel's first hit, and while the camera
+	// and the image size stay the same, trace only the shading and the
+	// secondary rays of later frames from it.
+	void setGBuffer(bool keep);
+	bool getGBuffer() const { return m_bGBuffer; }
+	// Find the first hits of a TRACE_NORMAL frame for the whole G-buffer
+	// at once with a PrimaryRaster, on the thread pool, before tracing
+	// from them.  The hits are the same, so is the image.
+	void setRasterPrimary(bool raster);
+	void prepareGBuffer(ThreadPool *pool);
+	// Cull the camera rays of a TRACE_NORMAL frame by tiles with a
+	// TileCuller, before tracing them.  The image is the same.
+	void setTileCulling(bool cull);
+	void prepareTiles(ThreadPool *pool);
 	bool sceneLoaded();
+	Scene *getScene() { return scene; }
 
-	void angleToSphere(vec3f di, double& u, double &v) const;
 	void loadBGImage(char *fn);
-	void setBG(bool b) { m_bBackground = b; }
+	void setBG(bool b) { m_bBackground = b; newSampleEpoch(); }
 
 private:
+	void allocBuffers();
+	bool deadlineStage( ThreadPool *pool, int block, int pass,
+						const std::chrono::steady_clock::time_point& deadline );
+	void newSampleEpoch();
+	vec3f cachedTrace( long long x, long long y, isect& i );
+	vec3f gbufferTrace( int i, int j, double x, double y );
+	vec3f culledTrace( int i, int j, double x, double y );
+	// whether a primary ray is traced under the current depth and threshold
+	bool gbufferUsable() const { return depth >= 0 && 1.0 > threshold - RAY_EPSILON; }
+	void validateGBuffer( bool keep );
+
 	unsigned char *buffer;
+	float *accum;				// running sum of every sample per pixel
+	float *accumSq;				// running sum of squared samples, for the variance
+	int *samples;				// number of samples summed in accum
 	int buffer_width, buffer_height;
-	int bufferSize;
+	size_t bufferSize;
 	int depth;
 	float dis_scale;
 	Scene *scene;
 	enum TraceMode mode;
 	int sampleSize;
+	Sampler sampler;
+	unsigned int sampleEpoch;	// identifies the adaptive samples' settings
+
+	double targetError;			// TRACE_VARIANCE stops once every pixel is below this
+	double timeBudget;			// or after this many seconds, if > 0
+	std::chrono::steady_clock::time_point frameStart;
 	bool ray_visual;
 
 	float threshold;
@@ -75,10 +146,22 @@ private:
 	bool m_bSceneLoaded;
 
 	bool m_bBackground;
-	int bg_width, bg_height;
-	unsigned char *bg;
 
-	vec3f n_ray;
+	int shadowMapSize;
+	int builtShadowMaps;		// the size the lights' maps were made with
+	float builtShadowCutoff;	// and the spot lights' cone
+
+	bool m_bGBuffer;
+	bool m_bRaster;				// fill the G-buffer by prepareGBuffer
+	std::deque<isect> gbuffer;	// every pixel's first hit, if gbufferState says so
+	vector<char> gbufferState;
+	int gbufferWidth;
+	Camera gbufferCamera;		// the view the hits were found from
+
+	bool m_bCull;
+	TileCuller tileCuller;		// built for the frame by prepareTiles
+
+	EnvironmentMap envmap;
 };
 
 #endif // __RAYTRACER_H__
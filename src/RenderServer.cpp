@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <sstream>
+#include <vector>
+
+#include "RenderServer.h"
+#include "RayTracer.h"
+#include "ThreadPool.h"
+#include "fileio/bitmap.h"
+#include "fileio/pfm.h"
+
+// Parse "x,y,z" into v.
+static bool parseVec( const string& s, vec3f& v )
+{
+	return sscanf( s.c_str(), "%lf,%lf,%lf", &v[0], &v[1], &v[2] ) == 3;
+}
+
+RenderRequest::RenderRequest()
+	: width( 150 ), depth( 2 ), mode( TRACE_NORMAL ), sampleSize( 1 ),
+	  pattern( SAMPLE_DEFAULT ), scramble( true ), passes( 1 ),
+	  targetError( 0.01 ), timeBudget( 0.0 ), deadline( 1.0 ), threshold( 0.0001 ),
+	  lightSamples( 0 ), shadowMaps( 0 ), gbuffer( false ), raster( false ), cull( false ),
+	  hasEye( false ), hasDir( false ), hasUp( false ), hasFov( false ), fov( 0.0 )
+{
+}
+
+bool RenderRequest::parse( const string& line, string& error )
+{
+	std::istringstream words( line );
+	string word;
+
+	while( words >> word ) {
+		size_t eq = word.find( '=' );
+		if( eq == string::npos ) {
+			error = "expected key=value, got " + word;
+			return false;
+		}
+		string key = word.substr( 0, eq );
+		string value = word.substr( eq + 1 );
+		bool ok = true;
+
+		if( key == "scene" )
+			scene = value;
+		else if( key == "out" )
+			output = value;
+		else if( key == "width" )
+			ok = (width = atoi( value.c_str() )) > 0;
+		else if( key == "depth" )
+			ok = (depth = atoi( value.c_str() )) >= 0;
+		else if( key == "mode" )
+			ok = (mode = atoi( value.c_str() )) >= 0 && mode < NUM_TRACE_MODE;
+		else if( key == "samples" )
+			ok = (sampleSize = atoi( value.c_str() )) > 0;
+		else if( key == "pattern" )
+			ok = (pattern = atoi( value.c_str() )) >= 0 && pattern < NUM_SAMPLE_PATTERN;
+		else if( key == "scramble" )
+			scramble = atoi( value.c_str() ) != 0;
+		else if( key == "passes" )
+			ok = (passes = atoi( value.c_str() )) > 0;
+		else if( key == "error" )
+			ok = (targetError = atof( value.c_str() )) >= 0.0;
+		else if( key == "budget" )
+			ok = (timeBudget = atof( value.c_str() )) >= 0.0;
+		else if( key == "deadline" )
+			ok = (deadline = atof( value.c_str() )) > 0.0;
+		else if( key == "eye" )
+			ok = hasEye = parseVec( value, eye );
+		else if( key == "dir" )
+			ok = hasDir = parseVec( value, dir );
+		else if( key == "up" )
+			ok = hasUp = parseVec( value, up );
+		else if( key == "fov" )
+			ok = hasFov = (fov = atof( value.c_str() )) > 0.0;
+		else if( key == "threshold" )
+			ok = (threshold = atof( value.c_str() )) >= 0.0;
+		else if( key == "lights" )
+			ok = (lightSamples = atoi( value.c_str() )) >= 0;
+		else if( key == "shadowmap" )
+			ok = (shadowMaps = atoi( value.c_str() )) >= 0;
+		else if( key == "gbuffer" )
+			gbuffer = atoi( value.c_str() ) != 0;
+		else if( key == "raster" )
+			raster = atoi( value.c_str() ) != 0;
+		else if( key == "cull" )
+			cull = atoi( value.c_str() ) != 0;
+		else {
+			error = "unknown key " + key;
+			return false;
+		}
+
+		if( !ok ) {
+			error = "bad value for " + key;
+			return false;
+		}
+	}
+
+	if( scene.empty() || output.empty() ) {
+		error = "scene= and out= are required";
+		return false;
+	}
+	return true;
+}
+
+RenderServer::RenderServer( ThreadPool *p, int cacheSize )
+	: capacity( cacheSize < 1 ? 1 : cacheSize ), pool( p )
+{
+}
+
+RenderServer::~RenderServer()
+{
+	for( list<CachedScene>::iterator c = cache.begin(); c != cache.end(); ++c )
+		delete c->tracer;
+}
+
+RayTracer *RenderServer::acquire( const string& path, string& error )
+{
+	for( list<CachedScene>::iterator c = cache.begin(); c != cache.end(); ++c ) {
+		if( c->path == path ) {
+			// move to the front and undo the previous request's camera
+			cache.splice( cache.begin(), cache, c );
+			*c->tracer->getScene()->getCamera() = c->camera;
+			return c->tracer;
+		}
+	}
+
+	RayTracer *tracer = new RayTracer();
+	std::vector<char> name( path.begin(), path.end() );
+	name.push_back( '\0' );
+	if( !tracer->loadScene( &name[0] ) ) {
+		delete tracer;
+		error = "can't load scene " + path;
+		return NULL;
+	}
+
+	CachedScene entry;
+	entry.path = path;
+	entry.tracer = tracer;
+	entry.camera = *tracer->getScene()->getCamera();
+	cache.push_front( entry );
+
+	while( (int)cache.size() > capacity ) {
+		delete cache.back().tracer;
+		cache.pop_back();
+	}
+
+	return tracer;
+}
+
+bool RenderServer::render( const RenderRequest& req, double& seconds, int& width, int& height,
+						   string& error )
+{
+	RayTracer *tracer = acquire( req.scene, error );
+	if( !tracer )
+		return false;
+
+	Camera *camera = tracer->getScene()->getCamera();
+	if( req.hasEye )
+		camera->setEye( req.eye );
+	if( req.hasDir || req.hasUp ) {
+		vec3f u, v, l;
+		camera->getUVL( u, v, l );
+		camera->setLook( (req.hasDir ? req.dir : l).normalize(),
+						 (req.hasUp ? req.up : v).normalize() );
+	}
+	if( req.hasFov )
+		camera->setFOV( req.fov );
+
+	width = req.width;
+	height = (int)(width / tracer->aspectRatio() + 0.5);
+
+	// a cached tracer still has the last request's settings
+	tracer->setLightSamples( req.lightSamples );
+	tracer->setShadowMaps( req.shadowMaps );
+	tracer->setGBuffer( req.gbuffer );
+	tracer->setRasterPrimary( req.raster );
+	tracer->setTileCulling( req.cull );
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	tracer->traceSetup( width, height, req.depth, 1.0, req.threshold );
+	tracer->setMode( (enum TraceMode)req.mode );
+	tracer->setSampleSize( req.sampleSize );
+	tracer->setSamplePattern( (enum SamplePattern)req.pattern );
+	tracer->setScramble( req.scramble );
+	tracer->setVarianceTarget( req.targetError, req.timeBudget );
+	for( int pass = 0; pass < req.passes; ++pass ) {
+		if( req.mode == TRACE_VARIANCE )
+			tracer->traceVariance( pool );
+		else if( req.mode == TRACE_DEADLINE )
+			tracer->traceDeadline( pool, req.deadline );
+		else
+			tracer->traceParallel( pool );
+	}
+
+	seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	std::vector<char> name( req.output.begin(), req.output.end() );
+	name.push_back( '\0' );
+	if( isPFMName( req.output.c_str() ) ) {
+		if( !tracer->saveHDR( &name[0] ) ) {
+			error = "can't write " + req.output;
+			return false;
+		}
+	}
+	else {
+		unsigned char *buf;
+		tracer->getBuffer( buf, width, height );
+		writeBMP( &name[0], width, height, buf );
+	}
+
+	return true;
+}
+
+void RenderServer::serve( istream& in, ostream& out, const RenderRequest& defaults )
+{
+	string line;
+
+	while( std::getline( in, line ) ) {
+		if( line.empty() || line[0] == '#' )
+			continue;
+		if( line == "quit" )
+			break;
+
+		RenderRequest req( defaults );
+		string error;
+		double seconds;
+		int width, height;
+
+		if( req.parse( line, error ) && render( req, seconds, width, height, error ) )
+			out << "ok " << req.output << " " << width << "x" << height << " "
+				<< seconds << " " << (int)(width * height / (seconds > 0.0 ? seconds : 1e-6))
+				<< std::endl;
+		else
+			out << "error " << error << std::endl;
+	}
+}
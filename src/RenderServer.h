@@ -0,0 +1,103 @@
+#ifndef __RENDERSERVER_H__
+#define __RENDERSERVER_H__
+
+// A long running render process.  Requests are read one per line, scenes
+// stay loaded (with their octree built) between requests in a small LRU
+// cache, and every frame is traced on one persistent thread pool.
+
+#include <string>
+#include <list>
+#include <iostream>
+
+#include "scene/camera.h"
+
+using std::string;
+using std::list;
+using std::istream;
+using std::ostream;
+
+class RayTracer;
+class ThreadPool;
+
+// One render job, written as whitespace separated key=value words:
+//
+//   scene=<file.ray> out=<file.bmp|file.pfm> [width=#] [depth=#]
+//   [mode=#] [samples=#] [pattern=#] [scramble=0|1] [passes=#]
+//   [error=#] [budget=#] [deadline=#] [eye=x,y,z] [dir=x,y,z] [up=x,y,z]
+//   [fov=#] [threshold=#] [lights=#] [shadowmap=#] [gbuffer=0|1]
+//   [raster=0|1] [cull=0|1]
+//
+// mode, samples and pattern are the trace mode, sample size and sample
+// pattern of the console -m, -n and -a options, error and budget the
+// variance mode's -e and -B, and deadline the deadline mode's -D.  eye, dir/up and fov override the scene's camera.
+// threshold is the ray threshold, and lights, shadowmap, gbuffer, raster
+// and cull are the console -L, -M, -G, -H and -F.  They are applied to the
+// scene's tracer for every request, whether it was cached or not.
+class RenderRequest
+{
+public:
+	RenderRequest();
+
+	// Fill in the fields named on line, returning false with a message in
+	// error if a word can't be understood.
+	bool parse( const string& line, string& error );
+
+	string scene;
+	string output;
+	int width;
+	int depth;
+	int mode;
+	int sampleSize;
+	int pattern;
+	bool scramble;
+	int passes;
+	double targetError;
+	double timeBudget;
+	double deadline;
+	double threshold;
+	int lightSamples;
+	int shadowMaps;
+	bool gbuffer;
+	bool raster;
+	bool cull;
+
+	bool hasEye, hasDir, hasUp, hasFov;
+	vec3f eye, dir, up;
+	double fov;
+};
+
+class RenderServer
+{
+public:
+	RenderServer( ThreadPool *pool, int cacheSize = 4 );
+	~RenderServer();
+
+	// Answer requests from in until it ends or a "quit" line arrives.  Each
+	// request gets one line on out: "ok <output> <w>x<h> <seconds> <pixels/s>"
+	// or "error <message>".  Each request starts from defaults, which is
+	// how the console batch mode renders many views of one scene file.
+	void serve( istream& in, ostream& out, const RenderRequest& defaults = RenderRequest() );
+
+	// Render one request, returning the wall clock time spent tracing and
+	// the size of the image.
+	bool render( const RenderRequest& req, double& seconds, int& width, int& height,
+				 string& error );
+
+	// The cached tracer for the scene file, loading it if needed.  The
+	// camera is reset to the one in the scene file.
+	RayTracer *acquire( const string& path, string& error );
+
+private:
+	struct CachedScene
+	{
+		string path;
+		RayTracer *tracer;
+		Camera camera;			// as loaded, before any override
+	};
+
+	list<CachedScene> cache;	// most recently used first
+	int capacity;
+	ThreadPool *pool;
+};
+
+#endif // __RENDERSERVER_H__
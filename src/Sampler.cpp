@@ -0,0 +1,103 @@
+#include <math.h>
+
+#include "Sampler.h"
+
+void Rng::setSeed( unsigned long long seed, unsigned long long stream )
+{
+	state = 0u;
+	inc = (stream << 1u) | 1u;
+	next();
+	state += seed;
+	next();
+}
+
+// A 64 bit mix of the pixel coordinates, so nearby pixels get unrelated
+// generator seeds.
+static unsigned long long hashPixel( int i, int j, int pass )
+{
+	unsigned long long h = (unsigned long long)(unsigned int)i
+		| ((unsigned long long)(unsigned int)j << 32);
+	h ^= (unsigned long long)(unsigned int)pass * 0x9E3779B97F4A7C15ULL;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+Sampler::Sampler()
+	: pattern( SAMPLE_DEFAULT ), scramble( true )
+{
+}
+
+double Sampler::radicalInverse( unsigned int base, unsigned int index )
+{
+	double inv = 1.0 / base, f = inv, r = 0.0;
+	while( index > 0 ) {
+		r += f * (index % base);
+		index /= base;
+		f *= inv;
+	}
+	return r;
+}
+
+// The second Sobol dimension.  Its direction numbers are v_k = v_{k-1} ^
+// (v_{k-1} >> 1), which the loop builds as it goes.  The first dimension
+// is radicalInverse( 2, index ).
+double Sampler::sobol2( unsigned int index )
+{
+	unsigned int r = 0;
+	for( unsigned int v = 1u << 31; index; index >>= 1, v ^= v >> 1 )
+		if( index & 1 )
+			r ^= v;
+	return r * (1.0 / 4294967296.0);
+}
+
+void Sampler::pixelSamples( int i, int j, int pass, int n, double *xy ) const
+{
+	int count = n * n;
+	Rng rng( hashPixel( i, j, pass ), 0 );
+
+	switch( pattern ) {
+	case SAMPLE_STRATIFIED:
+		for( int m = 0; m < n; ++m ) {
+			for( int k = 0; k < n; ++k ) {
+				*xy++ = (m + rng.uniform()) / n;
+				*xy++ = (k + rng.uniform()) / n;
+			}
+		}
+		break;
+
+	case SAMPLE_HALTON:
+	case SAMPLE_SOBOL: {
+		double dx = 0.0, dy = 0.0;
+		if( scramble ) {
+			// R2 sequence over the pixel grid
+			double t = i * 0.7548776662466927 + j * 0.5698402909980532;
+			dx = t - floor( t );
+			t = i * 0.5698402909980532 + j * 0.7548776662466927 + 0.5;
+			dy = t - floor( t );
+		}
+
+		unsigned int base = (unsigned int)pass * count;
+		for( int s = 0; s < count; ++s ) {
+			unsigned int index = base + s + 1;	// skip the point at the origin
+			double x = radicalInverse( 2, index );
+			double y = pattern == SAMPLE_HALTON ? radicalInverse( 3, index ) : sobol2( index );
+			x += dx;
+			y += dy;
+			*xy++ = x < 1.0 ? x : x - 1.0;
+			*xy++ = y < 1.0 ? y : y - 1.0;
+		}
+		break;
+	}
+
+	default:
+		for( int s = 0; s < count; ++s ) {
+			*xy++ = rng.uniform();
+			*xy++ = rng.uniform();
+		}
+		break;
+	}
+}
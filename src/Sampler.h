@@ -0,0 +1,71 @@
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+// Sub-pixel sample positions for the antialiasing modes.
+//
+// Every pixel seeds its own small generator from its coordinates and the
+// pass number, so the samples don't depend on which thread traces the
+// pixel or in what order, and nothing is shared between threads.
+
+enum SamplePattern {
+	SAMPLE_DEFAULT = 0,		// the mode's own pattern: a grid, or uniform jitter from the Rng
+	SAMPLE_STRATIFIED,		// one random sample in each cell of an n x n grid
+	SAMPLE_HALTON,			// Halton sequence in bases 2 and 3
+	SAMPLE_SOBOL,			// the first two dimensions of the Sobol sequence
+	NUM_SAMPLE_PATTERN
+};
+
+// PCG32 (O'Neill), a small and fast generator with good statistics.
+class Rng
+{
+public:
+	Rng( unsigned long long seed = 0, unsigned long long stream = 0 ) { setSeed( seed, stream ); }
+
+	void setSeed( unsigned long long seed, unsigned long long stream );
+
+	unsigned int next()
+	{
+		unsigned long long old = state;
+		state = old * 6364136223846793005ULL + inc;
+		unsigned int xorshifted = (unsigned int)(((old >> 18u) ^ old) >> 27u);
+		unsigned int rot = (unsigned int)(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((-(int)rot) & 31));
+	}
+
+	// uniform in [0,1)
+	double uniform() { return next() * (1.0 / 4294967296.0); }
+
+private:
+	unsigned long long state, inc;
+};
+
+class Sampler
+{
+public:
+	Sampler();
+
+	void setPattern( SamplePattern p ) { pattern = p; }
+	SamplePattern getPattern() const { return pattern; }
+
+	// Shift each pixel's copy of the Halton and Sobol points by its own
+	// offset.  The offsets come from a low discrepancy sequence over the
+	// pixel grid, so neighbouring pixels get well separated shifts and the
+	// leftover error looks like fine, blue noise instead of structure
+	// repeated in every pixel.
+	void setScramble( bool s ) { scramble = s; }
+	bool getScramble() const { return scramble; }
+
+	// Write n*n sample offsets within pixel (i,j), each in [0,1)^2, to xy as
+	// x0 y0 x1 y1 ...  pass numbers successive batches for the same pixel
+	// so that the sequences carry on where the previous pass stopped.
+	void pixelSamples( int i, int j, int pass, int n, double *xy ) const;
+
+	static double radicalInverse( unsigned int base, unsigned int index );
+	static double sobol2( unsigned int index );
+
+private:
+	SamplePattern pattern;
+	bool scramble;
+};
+
+#endif // __SAMPLER_H__
@@ -14,6 +14,7 @@ public:
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual bool encloses() const { return false; }
 
     virtual BoundingBox ComputeLocalBoundingBox()
     {
@@ -1,5 +1,6 @@
 #include <cmath>
 #include <float.h>
+#include <map>
 #include "trimesh.h"
 
 Trimesh::~Trimesh()
@@ -41,6 +42,46 @@ bool Trimesh::addFace( int a, int b, int c )
     return true;
 }
 
+bool Trimesh::isClosedMesh()
+{
+    if( closedMesh < 0 )
+    {
+        // meshes are often written as separate triangles, so vertices at
+        // the same position count as one
+        std::map< std::vector<double>, int > positions;
+        std::vector<int> weld( vertices.size() );
+        for( size_t v = 0; v < vertices.size(); ++v )
+        {
+            std::vector<double> p( 3 );
+            p[0] = vertices[v][0];
+            p[1] = vertices[v][1];
+            p[2] = vertices[v][2];
+            weld[v] = positions.insert( std::make_pair( p, (int)v ) ).first->second;
+        }
+
+        std::map< std::pair<int,int>, int > edges;
+        for( Faces::iterator f = faces.begin(); f != faces.end(); ++f )
+        {
+            for( int k = 0; k < 3; ++k )
+            {
+                int a = weld[(**f)[k]], b = weld[(**f)[(k + 1) % 3]];
+                ++edges[ a < b ? std::make_pair( a, b ) : std::make_pair( b, a ) ];
+            }
+        }
+
+        closedMesh = !faces.empty();
+        for( std::map< std::pair<int,int>, int >::iterator e = edges.begin(); e != edges.end(); ++e )
+        {
+            if( e->second != 2 )
+            {
+                closedMesh = 0;
+                break;
+            }
+        }
+    }
+    return closedMesh != 0;
+}
+
 char *
 Trimesh::doubleCheck()
 // Check to make sure that if we have per-vertex materials or normals
@@ -20,9 +20,10 @@ class Trimesh : public MaterialSceneObject
     Faces faces;
     Normals normals;
     Materials materials;
+    int closedMesh;     // -1 until isClosedMesh() has looked
 public:
     Trimesh( Scene *scene, Material *mat, TransformNode *transform )
-        : MaterialSceneObject(scene, mat)
+        : MaterialSceneObject(scene, mat), closedMesh(-1)
     {
         this->transform = transform;
     }
@@ -39,6 +40,9 @@ public:
     char *doubleCheck();
     
     void generateNormals();
+
+    // true if every edge is shared by exactly two faces
+    bool isClosedMesh();
 };
 
 class TrimeshFace : public MaterialSceneObject
@@ -63,6 +67,17 @@ public:
     virtual bool intersectLocal( const ray& r, isect& i ) const;
 
     virtual bool hasBoundingBoxCapability() const { return true; }
+
+    virtual bool getTriangle( vec3f& a, vec3f& b, vec3f& c ) const
+    {
+        a = transform->localToGlobalCoords( parent->vertices[ids[0]] );
+        b = transform->localToGlobalCoords( parent->vertices[ids[1]] );
+        c = transform->localToGlobalCoords( parent->vertices[ids[2]] );
+        return true;
+    }
+
+    // a face of a closed mesh bounds the mesh's interior
+    virtual bool encloses() const { return parent->isClosedMesh(); }
       
     virtual BoundingBox ComputeLocalBoundingBox()
     {
@@ -0,0 +1,66 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool( int nthreads )
+	: current( NULL ), next( 0 ), count( 0 ), running( 0 ), quit( false )
+{
+	if( nthreads <= 0 )
+		nthreads = std::thread::hardware_concurrency();
+	if( nthreads <= 0 )
+		nthreads = 1;
+
+	for( int i = 0; i < nthreads; ++i )
+		workers.push_back( std::thread( &ThreadPool::workerLoop, this ) );
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> guard( lock );
+		quit = true;
+	}
+	wake.notify_all();
+	for( size_t i = 0; i < workers.size(); ++i )
+		workers[i].join();
+}
+
+void ThreadPool::run( int n, const std::function<void(int)>& job )
+{
+	if( n <= 0 )
+		return;
+
+	std::unique_lock<std::mutex> guard( lock );
+	current = &job;
+	next = 0;
+	count = n;
+	running = 0;
+	wake.notify_all();
+
+	// wait until every job has been taken and every taker is done
+	while( next < count || running > 0 )
+		finished.wait( guard );
+	current = NULL;
+}
+
+void ThreadPool::workerLoop()
+{
+	std::unique_lock<std::mutex> guard( lock );
+
+	while( true ) {
+		while( !quit && (!current || next >= count) )
+			wake.wait( guard );
+		if( quit )
+			return;
+
+		int job = next++;
+		++running;
+		const std::function<void(int)> *fn = current;
+
+		guard.unlock();
+		(*fn)( job );
+		guard.lock();
+
+		--running;
+		if( next >= count && running == 0 )
+			finished.notify_all();
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+// A fixed set of worker threads that stay alive between renders, so that
+// starting a frame doesn't pay for creating and joining threads.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+using std::vector;
+
+class ThreadPool
+{
+public:
+	// nthreads <= 0 uses one thread per hardware core
+	ThreadPool( int nthreads = 0 );
+	~ThreadPool();
+
+	int size() const { return (int)workers.size(); }
+
+	// Call job(0) ... job(count-1) spread over the workers and return once
+	// all of them have finished.  Jobs are handed out in increasing order.
+	void run( int count, const std::function<void(int)>& job );
+
+private:
+	void workerLoop();
+
+	vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable finished;
+
+	const std::function<void(int)> *current;
+	int next, count, running;
+	bool quit;
+};
+
+#endif // __THREADPOOL_H__
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cfloat>
+#include <functional>
+#include <unordered_map>
+
+#include "TileCull.h"
+#include "ThreadPool.h"
+#include "scene/camera.h"
+#include "scene/Frustum.h"
+
+// pixels on a side of a tile
+static const int CULL_TILE = 8;
+
+// hits closer together than this are left to Scene::intersect
+static const double CULL_TIE = 2 * RAY_EPSILON;
+
+// Which ray each of a tile's objects was last tried on, so that one in
+// several leaves is tried once.  The numbers go on from tile to tile.
+static thread_local vector<unsigned int> tried;
+static thread_local unsigned int ray_number = 0;
+
+TileCuller::TileCuller()
+	: scene( NULL ), width( 0 ), height( 0 ), tilesWide( 0 )
+{
+}
+
+void TileCuller::clear()
+{
+	tiles.clear();
+	scene = NULL;
+}
+
+void TileCuller::build( Scene *scene, int width, int height, ThreadPool *pool )
+{
+	this->scene = scene;
+	this->width = width;
+	this->height = height;
+	tilesWide = (width + CULL_TILE - 1) / CULL_TILE;
+	int tilesHigh = (height + CULL_TILE - 1) / CULL_TILE;
+	tiles.assign( (size_t)tilesWide * tilesHigh, Tile() );
+
+	std::function<void(int)> job = [this]( int row ) {
+		for( int tile = row * tilesWide; tile < (row + 1) * tilesWide; ++tile )
+			cullTile( tile );
+	};
+	if( pool && pool->size() > 1 )
+		pool->run( tilesHigh, job );
+	else
+		for( int row = 0; row < tilesHigh; ++row )
+			job( row );
+}
+
+static double boxDistance( const vec3f& p, const BoundingBox& box )
+{
+	return (minimum( maximum( p, box.min ), box.max ) - p).length();
+}
+
+// Find what the rays of one tile could hit.  Its frustum goes through the
+// outer edges of its outer pixels, half a pixel clear of their rays.
+void TileCuller::cullTile( int tile )
+{
+	int i0 = (tile % tilesWide) * CULL_TILE, i1 = std::min( i0 + CULL_TILE, width );
+	int j0 = (tile / tilesWide) * CULL_TILE, j1 = std::min( j0 + CULL_TILE, height );
+
+	Camera *camera = scene->getCamera();
+	ray r( vec3f(0,0,0), vec3f(0,0,0) );
+	vec3f corner[4];
+	camera->rayThrough( double(i0)/double(width), double(j0)/double(height), r );
+	corner[0] = r.getDirection();
+	camera->rayThrough( double(i1)/double(width), double(j0)/double(height), r );
+	corner[1] = r.getDirection();
+	camera->rayThrough( double(i1)/double(width), double(j1)/double(height), r );
+	corner[2] = r.getDirection();
+	camera->rayThrough( double(i0)/double(width), double(j1)/double(height), r );
+	corner[3] = r.getDirection();
+	vec3f eye = r.getPosition();
+	Frustum f( eye, corner );
+
+	Tile& t = tiles[tile];
+	t.objects.assign( scene->beginNonboundedObjects(), scene->endNonboundedObjects() );
+	t.unbounded = (int)t.objects.size();
+
+	vector<SceneCell> found;
+	scene->cull( f, found );
+
+	// each object is looked at once, and kept if f meets its box
+	std::unordered_map<const Geometry*, int> index;
+	vector< std::pair<double, int> > order;
+	vector<Cell> cells;
+	for( size_t k = 0; k < found.size(); ++k ) {
+		Cell c;
+		c.box.min = found[k].box.min - vec3f( RAY_EPSILON, RAY_EPSILON, RAY_EPSILON );
+		c.box.max = found[k].box.max + vec3f( RAY_EPSILON, RAY_EPSILON, RAY_EPSILON );
+		c.near = boxDistance( eye, found[k].box );
+		c.first = (int)t.members.size();
+		for( list<Geometry*>::const_iterator j = found[k].objects->begin(); j != found[k].objects->end(); ++j ) {
+			std::pair<std::unordered_map<const Geometry*, int>::iterator, bool> in
+				= index.insert( std::make_pair( *j, -1 ) );
+			if( in.second && f.overlaps( (*j)->getBoundingBox() ) ) {
+				in.first->second = (int)t.objects.size();
+				t.objects.push_back( *j );
+			}
+			if( in.first->second >= 0 )
+				t.members.push_back( in.first->second );
+		}
+		c.count = (int)t.members.size() - c.first;
+		if( c.count ) {
+			order.push_back( std::make_pair( c.near, (int)cells.size() ) );
+			cells.push_back( c );
+		}
+	}
+
+	std::sort( order.begin(), order.end() );
+	for( size_t k = 0; k < order.size(); ++k )
+		t.cells.push_back( cells[order[k].second] );
+}
+
+// Where r enters box, if it does, for a box grown enough that no test on
+// the border matters.
+static bool enters( const BoundingBox& box, const ray& r, double& tnear )
+{
+	const vec3f& p = r.getPosition();
+	const vec3f& d = r.getDirection();
+	double from = 0.0, to = DBL_MAX;
+	for( int a = 0; a < 3; ++a ) {
+		double t1 = (box.min[a] - p[a]) / d[a];
+		double t2 = (box.max[a] - p[a]) / d[a];
+		if( t1 > t2 )
+			std::swap( t1, t2 );
+		from = t1 > from ? t1 : from;		// a NaN from 0 / 0 changes neither
+		to = t2 < to ? t2 : to;
+	}
+	tnear = from;
+	return from <= to;
+}
+
+bool TileCuller::intersect( int i, int j, const ray& r, isect& hit ) const
+{
+	const Tile& t = tiles[i / CULL_TILE + (size_t)(j / CULL_TILE) * tilesWide];
+	if( t.objects.empty() )
+		return false;
+
+	if( tried.size() < t.objects.size() )
+		tried.resize( t.objects.size(), 0 );
+	if( ++ray_number == 0 ) {
+		std::fill( tried.begin(), tried.end(), 0 );
+		ray_number = 1;
+	}
+
+	isect cur;
+	bool have = false, tie = false;
+	double best = 0.0;
+	auto tryObject = [&]( int k ) {
+		if( !scene->intersectObject( t.objects[k], r, cur ) )
+			return;
+		if( have ) {
+			if( cur.t > best + CULL_TIE )
+				return;
+			tie = cur.t >= best - CULL_TIE;
+			if( cur.t >= best )
+				return;
+		}
+		have = true;
+		best = cur.t;
+		hit = cur;
+	};
+
+	for( int k = 0; k < t.unbounded; ++k )
+		tryObject( k );
+
+	for( size_t c = 0; c < t.cells.size(); ++c ) {
+		const Cell& cell = t.cells[c];
+		if( have && cell.near > best + CULL_TIE )
+			break;
+		double tnear;
+		if( !enters( cell.box, r, tnear ) || (have && tnear > best + CULL_TIE) )
+			continue;
+		for( int m = cell.first; m < cell.first + cell.count; ++m ) {
+			int k = t.members[m];
+			if( tried[k] != ray_number ) {
+				tried[k] = ray_number;
+				tryObject( k );
+			}
+		}
+	}
+
+	if( tie )
+		return scene->intersect( r, hit );
+	return have;
+}
@@ -0,0 +1,66 @@
+#ifndef __TILECULL_H__
+#define __TILECULL_H__
+
+// Camera rays culled a tile of pixels at a time.
+//
+// The rays through the pixels of a square tile all lie in the frustum of
+// the rays through its corners.  Before a frame, each tile's frustum walks
+// down the octree once, passing over every subtree it misses, and keeps
+// the leaves it goes through, nearest first, with the objects in them
+// whose boxes it meets.  A tile whose frustum misses them all sees only
+// the background, and its rays aren't tested against anything.  The rays
+// of the others try the tile's leaves instead of walking the octree: a
+// leaf the ray misses, or one farther than what it has already hit, is
+// passed over, and an object in several leaves is tried only once.
+//
+// The objects are hit with Scene::intersectObject, so a ray gets the same
+// hit as from Scene::intersect, and one that meets two objects at all but
+// the same distance is left to Scene::intersect to settle.
+
+#include <vector>
+
+#include "scene/ray.h"
+#include "scene/scene.h"
+
+using std::vector;
+
+class ThreadPool;
+
+class TileCuller
+{
+public:
+	TileCuller();
+
+	// Cull the tiles of a width x height image of scene from its camera,
+	// a job per row of tiles on pool.
+	void build( Scene *scene, int width, int height, ThreadPool *pool );
+	void clear();
+	bool ready() const { return !tiles.empty(); }
+
+	// Scene::intersect for the camera ray r through pixel (i, j).
+	bool intersect( int i, int j, const ray& r, isect& hit ) const;
+
+private:
+	// a leaf of the octree in a tile's view
+	struct Cell {
+		BoundingBox box;			// grown by RAY_EPSILON
+		double near;				// distance from the eye to the box
+		int first, count;			// its objects in members
+	};
+
+	struct Tile {
+		vector<const Geometry*> objects;	// all it sees, the unbounded ones first
+		int unbounded;
+		vector<Cell> cells;					// nearest first
+		vector<int> members;				// the objects of each cell, by index
+	};
+
+	void cullTile( int tile );
+
+	Scene *scene;
+	int width, height;
+	int tilesWide;
+	vector<Tile> tiles;
+};
+
+#endif // __TILECULL_H__
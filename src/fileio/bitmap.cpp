@@ -108,15 +108,34 @@ void writeBMP(char*				iname,
 			  int				width, 
 			  int				height, 
 			  unsigned char*	data) 
-{ 
-	int bytes, pad;
-	bytes = width * 3;
+{ 
+	FILE *outFile = beginBMP( iname, width, height );
+	if ( !outFile )
+		return;
+
+	writeBMPLines( outFile, width, height, data );
+	endBMP( outFile );
+}
+
+// Write the file and info headers for a width x height 24 bit bitmap and
+// leave the file positioned at the first (bottom) scanline.  Sizes are
+// computed in 64 bits; bitmaps whose pixel data does not fit in the 32 bit
+// size field of the header are refused.
+FILE* beginBMP(char*	iname,
+			   int		width,
+			   int		height)
+{
+	unsigned long long bytes, pad;
+	bytes = (unsigned long long)width * 3;
 	pad = (bytes%4) ? 4-(bytes%4) : 0;
 	bytes += pad;
 	bytes *= height;
 
+	if ( bytes + sizeof(BMP_BITMAPFILEHEADER) + sizeof(BMP_BITMAPINFOHEADER) > 0xffffffffULL )
+		return NULL;
+
 	bmfh.bfType = 0x4d42;    // "BM"
-	bmfh.bfSize = sizeof(BMP_BITMAPFILEHEADER) + sizeof(BMP_BITMAPINFOHEADER) + bytes;
+	bmfh.bfSize = (BMP_DWORD)(sizeof(BMP_BITMAPFILEHEADER) + sizeof(BMP_BITMAPINFOHEADER) + bytes);
 	bmfh.bfReserved1 = 0;
 	bmfh.bfReserved2 = 0;
 	bmfh.bfOffBits = sizeof(BMP_BITMAPFILEHEADER) + sizeof(BMP_BITMAPINFOHEADER);
@@ -134,6 +153,8 @@ void writeBMP(char*				iname,
 	bmih.biClrImportant = 0;
 
 	FILE *outFile=fopen(iname, "wb"); 
+	if ( !outFile )
+		return NULL;
 
 	fwrite(&bmfh, sizeof(BMP_BITMAPFILEHEADER), 1, outFile);
 	/*
@@ -146,11 +167,27 @@ void writeBMP(char*				iname,
 
 	fwrite(&bmih, sizeof(BMP_BITMAPINFOHEADER), 1, outFile); 
 
-	bytes /= height;
+	return outFile;
+}
+
+// Append nlines scanlines of (R,G,B) tuples in row-major order, bottom
+// scanline first.  The file is flushed afterwards so that everything
+// written so far survives if the render is killed.
+void writeBMPLines(FILE*			outFile,
+				   int				width,
+				   int				nlines,
+				   unsigned char*	data)
+{
+	size_t bytes, pad;
+	bytes = (size_t)width * 3;
+	pad = (bytes%4) ? 4-(bytes%4) : 0;
+	bytes += pad;
+
 	unsigned char* scanline = new unsigned char [bytes];
-	for ( int j = 0; j < height; ++j )
+	memset( scanline, 0, bytes );
+	for ( int j = 0; j < nlines; ++j )
 	{
-		memcpy( scanline, data + j*3*width, bytes );
+		memcpy( scanline, data + (size_t)j*3*width, (size_t)width*3 );
 		for ( int i = 0; i < width; ++i )
 		{
 			unsigned char temp = scanline[i*3];
@@ -162,5 +199,10 @@ void writeBMP(char*				iname,
 
 	delete [] scanline;
 
+	fflush(outFile);
+}
+
+void endBMP(FILE* outFile)
+{
 	fclose(outFile);
-} 
\ No newline at end of file
+}
@@ -45,4 +45,10 @@ typedef struct {
 extern unsigned char* readBMP( char* fname, int& width, int& height );
 extern void writeBMP( char* iname, int width, int height, unsigned char* data ); 
 
+// streaming output: the header is written up front and the scanlines are
+// appended bottom-up, a band at a time, as the renderer finishes them.
+extern FILE* beginBMP( char* iname, int width, int height );
+extern void writeBMPLines( FILE* outFile, int width, int nlines, unsigned char* data );
+extern void endBMP( FILE* outFile );
+
 #endif
\ No newline at end of file
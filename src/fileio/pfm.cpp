@@ -0,0 +1,50 @@
+//
+// pfm.cpp
+//
+// handle PFM output.  A PFM file is a short text header followed by raw
+// 32 bit floats; a negative scale factor in the header marks the data as
+// little endian.  Scanlines are stored bottom to top, which is the order
+// the ray tracer keeps them in anyway.
+//
+
+#include <string.h>
+
+#include "pfm.h"
+
+static bool littleEndian()
+{
+	unsigned int one = 1;
+	return *(unsigned char *)&one == 1;
+}
+
+FILE* beginPFM(char*	iname,
+			   int		width,
+			   int		height)
+{
+	FILE *outFile=fopen(iname, "wb");
+	if ( !outFile )
+		return NULL;
+
+	fprintf( outFile, "PF\n%d %d\n%s\n", width, height, littleEndian() ? "-1.0" : "1.0" );
+
+	return outFile;
+}
+
+void writePFMLines(FILE*	outFile,
+				   int		width,
+				   int		nlines,
+				   float*	data)
+{
+	fwrite( data, sizeof(float) * 3 * width, nlines, outFile );
+}
+
+void endPFM(FILE* outFile)
+{
+	fclose(outFile);
+}
+
+bool isPFMName(const char* name)
+{
+	size_t len = strlen( name );
+	return len > 4 && !strcmp( name + len - 4, ".pfm" );
+}
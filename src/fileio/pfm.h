@@ -0,0 +1,22 @@
+//
+// pfm.h
+//
+// header file for the portable float map (PFM) format, used to save the
+// floating point accumulation buffer without quantizing it to 8 bits
+//
+
+#ifndef PFM_H
+#define PFM_H
+
+#include <stdio.h>
+
+// the header is written up front and the scanlines, (R,G,B) float tuples,
+// are appended bottom-up like in writeBMPLines
+extern FILE* beginPFM( char* iname, int width, int height );
+extern void writePFMLines( FILE* outFile, int width, int nlines, float* data );
+extern void endPFM( FILE* outFile );
+
+// whether an output file name asks for a PFM, that is, ends in .pfm
+extern bool isPFMName( const char* name );
+
+#endif
@@ -56,6 +56,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
 
 #include <FL/Fl.h>
 #include <FL/Fl_Window.H>
@@ -65,8 +68,11 @@
 
 #include "ui/TraceUI.h"
 #include "RayTracer.h"
+#include "ThreadPool.h"
+#include "RenderServer.h"
 
 #include "fileio/bitmap.h"
+#include "fileio/pfm.h"
 
 // ***********************************************************
 // from getopt.cpp 
@@ -83,11 +89,29 @@ TraceUI* traceUI;
 //
 // options from program parameters
 //
-int recursion_depth = 0;
+int recursion_depth = 2;
+int g_lightSamples = 0;
+int g_shadowMaps = 0;
+bool g_gbuffer = false;
+bool g_raster = false;
+bool g_cull = false;
 int g_height;
 int g_width = 150;
+int g_band = 0;
+int g_mode = TRACE_NORMAL;
+int g_sampleSize = 1;
+int g_passes = 1;
+double g_error = 0.01;
+double g_budget = 0.0;
+double g_deadline = 1.0;
+int g_pattern = SAMPLE_DEFAULT;
+bool g_scramble = true;
+int g_threads = 1;
+int g_cacheSize = 4;
+bool bServer = false;
+char *batchName = NULL;
 bool bReport = false;
-char *progname, *rayName, *imgName;
+char *progname, *rayName, *imgName, *bgName = NULL;
 
 void usage()
 {
@@ -96,15 +120,37 @@ void usage()
 #else
 	fprintf( stderr, "usage: %s [options] [input.ray output.bmp]\n", progname );
 	fprintf( stderr, "  -r <#>      set recurssion level (default %d)\n", recursion_depth );
+	fprintf( stderr, "  -L <#>      shade with # lights picked at random by importance (default all)\n" );
+	fprintf( stderr, "  -M <#>      preview shadows from # x # shadow maps (default traced)\n" );
+	fprintf( stderr, "  -G          mode 0: keep the first hits and only reshade them on later passes\n" );
+	fprintf( stderr, "  -H          mode 0: find the first hits by rasterizing, then trace on from them\n" );
+	fprintf( stderr, "  -F          mode 0: cull the camera rays by 8x8 tiles of pixels\n" );
 	fprintf( stderr, "  -w <#>      set output image width (default %d)\n", g_width );
 	fprintf( stderr, "  -t			report time statistics\n" );
+	fprintf( stderr, "  -s <#>      stream the image to disk in bands of # scanlines\n" );
+	fprintf( stderr, "  -m <#>      trace mode: 0 normal, 1 supersample, 2 jitter, 3 adaptive,\n" );
+	fprintf( stderr, "              4 variance, 5 deadline (neither with -s)\n" );
+	fprintf( stderr, "  -e <#>      variance mode: target standard error per pixel (default %g)\n", g_error );
+	fprintf( stderr, "  -B <#>      variance mode: stop after # seconds (default none)\n" );
+	fprintf( stderr, "  -D <#>      deadline mode: best image within # seconds (default %g)\n", g_deadline );
+	fprintf( stderr, "  -n <#>      antialias sample size (default %d)\n", g_sampleSize );
+	fprintf( stderr, "  -a <#>      sample pattern: 0 mode default, 1 stratified, 2 Halton, 3 Sobol\n" );
+	fprintf( stderr, "  -u          don't scramble the Halton and Sobol points per pixel\n" );
+	fprintf( stderr, "  -p <#>      accumulate # progressive passes (default %d)\n", g_passes );
+	fprintf( stderr, "  -g <file>   use a latitude-longitude background image\n" );
+	fprintf( stderr, "  -j <#>      render with # threads, 0 for one per core (default %d)\n", g_threads );
+	fprintf( stderr, "  -d          serve render requests from stdin instead\n" );
+	fprintf( stderr, "  -b <file>   render every view listed in file from one scene load\n" );
+	fprintf( stderr, "              (one line per view, key=value words as for -d)\n" );
+	fprintf( stderr, "  -c <#>      number of scenes the server keeps loaded (default %d)\n", g_cacheSize );
+	fprintf( stderr, "  an output name ending in .pfm saves the float image\n" );
 #endif
 }
 
 bool processArgs(int argc, char **argv) {
 	int i;
 
-    while ( (i = getopt( argc, argv, "tr:w:h:" )) != EOF )
+    while ( (i = getopt( argc, argv, "tduGHFL:M:r:w:h:s:m:n:a:p:g:j:c:b:e:B:D:" )) != EOF )
 	{
 		switch ( i )
 		{
@@ -115,6 +161,26 @@ bool processArgs(int argc, char **argv) {
 			case 'r':
 			recursion_depth = atoi( optarg );
 			break;
+
+			case 'L':
+			g_lightSamples = atoi( optarg );
+			break;
+
+			case 'M':
+			g_shadowMaps = atoi( optarg );
+			break;
+
+			case 'G':
+			g_gbuffer = true;
+			break;
+
+			case 'H':
+			g_raster = true;
+			break;
+
+			case 'F':
+			g_cull = true;
+			break;
 	    
 			case 'w':
 			g_width = atoi( optarg );
@@ -124,11 +190,94 @@ bool processArgs(int argc, char **argv) {
 			g_height = atoi( optarg );
 			break;
 
+			case 's':
+			g_band = atoi( optarg );
+			break;
+
+			case 'm':
+			g_mode = atoi( optarg );
+			if ( g_mode < 0 || g_mode >= NUM_TRACE_MODE )
+				return false;
+			break;
+
+			case 'n':
+			g_sampleSize = atoi( optarg );
+			break;
+
+			case 'e':
+			g_error = atof( optarg );
+			break;
+
+			case 'B':
+			g_budget = atof( optarg );
+			break;
+
+			case 'D':
+			g_deadline = atof( optarg );
+			break;
+
+			case 'a':
+			g_pattern = atoi( optarg );
+			if ( g_pattern < 0 || g_pattern >= NUM_SAMPLE_PATTERN )
+				return false;
+			break;
+
+			case 'u':
+			g_scramble = false;
+			break;
+
+			case 'p':
+			g_passes = atoi( optarg );
+			break;
+
+			case 'g':
+			bgName = optarg;
+			break;
+
+			case 'j':
+			g_threads = atoi( optarg );
+			break;
+
+			case 'd':
+			bServer = true;
+			break;
+
+			case 'c':
+			g_cacheSize = atoi( optarg );
+			break;
+
+			case 'b':
+			batchName = optarg;
+			break;
+
 			default:
 			return false;
 		}
     }
 
+	// variance and deadline rendering revisit pixels, so they need the
+	// whole frame
+	if ( g_band > 0 && (g_mode == TRACE_VARIANCE || g_mode == TRACE_DEADLINE) )
+		return false;
+
+	// the rasterized hits go in the G-buffer, which a band at a time has not
+	if ( g_raster && g_band > 0 )
+		return false;
+
+	// the server takes its scene and image names from each request
+	if ( bServer )
+		return true;
+
+	// a batch takes the scene name only, the outputs are in the job list
+	if ( batchName ) {
+		if ( optind >= argc ) {
+			fprintf( stderr, "no input name.\n" );
+			return false;
+		}
+		rayName = argv[optind];
+		return true;
+	}
+
     if ( optind >= argc-1 )
     {
 		fprintf( stderr, "no input and/or output name.\n" );
@@ -160,35 +309,125 @@ int main(int argc, char **argv) {
 			exit(1);
 		}
 		
+		ThreadPool pool(g_threads);
+
+		// server requests and batch views start from the command line
+		// settings
+		RenderRequest defaults;
+		defaults.width = g_width;
+		defaults.depth = recursion_depth;
+		defaults.mode = g_mode;
+		defaults.sampleSize = g_sampleSize;
+		defaults.pattern = g_pattern;
+		defaults.scramble = g_scramble;
+		defaults.passes = g_passes;
+		defaults.targetError = g_error;
+		defaults.timeBudget = g_budget;
+		defaults.deadline = g_deadline;
+		defaults.lightSamples = g_lightSamples;
+		defaults.shadowMaps = g_shadowMaps;
+		defaults.gbuffer = g_gbuffer;
+		defaults.raster = g_raster;
+		defaults.cull = g_cull;
+
+		if (bServer) {
+			RenderServer server(&pool, g_cacheSize);
+			server.serve(std::cin, std::cout, defaults);
+			return 0;
+		}
+
+		if (batchName) {
+			std::ifstream jobs(batchName);
+			if (!jobs) {
+				fprintf( stderr, "can't open %s\n", batchName );
+				return 1;
+			}
+
+			// load once up front so the background goes on the cached scene
+			RenderServer server(&pool, 1);
+			std::string error;
+			RayTracer *tracer = server.acquire(rayName, error);
+			if (!tracer) {
+				fprintf( stderr, "%s\n", error.c_str() );
+				return 1;
+			}
+			if (bgName) {
+				tracer->loadBGImage(bgName);
+				tracer->setBG(true);
+			}
+
+			defaults.scene = rayName;
+			server.serve(jobs, std::cout, defaults);
+			return 0;
+		}
+
 		theRayTracer=new RayTracer();
 		theRayTracer->loadScene(rayName);
 	
 		if (theRayTracer->sceneLoaded()) {
 			g_height = (int)(g_width / theRayTracer->aspectRatio() + 0.5);
 
-			theRayTracer->traceSetup(g_width, g_height, 2, 1.0, 0.0001);
+			theRayTracer->traceSetup(g_width, g_height, recursion_depth, 1.0, 0.0001, g_band > 0);
+			theRayTracer->setMode((enum TraceMode)g_mode);
+			theRayTracer->setSampleSize(g_sampleSize);
+			theRayTracer->setSamplePattern((enum SamplePattern)g_pattern);
+			theRayTracer->setScramble(g_scramble);
+			theRayTracer->setVarianceTarget(g_error, g_budget);
+			theRayTracer->setLightSamples(g_lightSamples);
+			theRayTracer->setShadowMaps(g_shadowMaps);
+			theRayTracer->setGBuffer(g_gbuffer);
+			theRayTracer->setRasterPrimary(g_raster);
+			theRayTracer->setTileCulling(g_cull);
+			if (bgName) {
+				theRayTracer->loadBGImage(bgName);
+				theRayTracer->setBG(true);
+			}
 		
-			clock_t start, end;
-			start=clock();
+			// wall time, which clock() overstates once several threads run
+			std::chrono::steady_clock::time_point start, end;
+			start=std::chrono::steady_clock::now();
+			long long nsamples = 0;
+			int nstages = 0;
 
-			theRayTracer->traceLines(0, g_height);
+			if (g_band > 0) {
+				// finished bands go straight to disk, there is no frame buffer
+				if (!theRayTracer->traceStream(&pool, imgName, g_band))
+					fprintf( stderr, "can't write %s\n", imgName );
+			} else {
+				// every pass adds to the accumulation buffer
+				for (int pass = 0; pass < g_passes; ++pass) {
+					if (g_mode == TRACE_VARIANCE)
+						nsamples = theRayTracer->traceVariance(&pool);
+					else if (g_mode == TRACE_DEADLINE)
+						nstages = theRayTracer->traceDeadline(&pool, g_deadline);
+					else
+						theRayTracer->traceParallel(&pool);
+				}
+			}
 		
-			end=clock();
+			end=std::chrono::steady_clock::now();
 
 			// save image
 			unsigned char* buf;
 
 			theRayTracer->getBuffer(buf, g_width, g_height);
-			if (buf)
+			// a .pfm gets the float accumulation buffer
+			if (isPFMName(imgName))
+				theRayTracer->saveHDR(imgName);
+			else if (buf)
 				writeBMP(imgName, g_width, g_height, buf); 
 
 			if (bReport) {
-				double t=(double)(end-start)/CLOCKS_PER_SEC;
+				double t=std::chrono::duration<double>(end-start).count();
 #ifdef WIN32
 				fl_message( "total time = %.3f seconds\n", t); 
 #else
 				fprintf( stderr, "total time = %.3f seconds\n", t); 
 #endif
+				if (nsamples > 0)
+					fprintf( stderr, "%.1f samples per pixel\n", (double)nsamples / ((double)g_width * g_height) );
+				if (nstages > 0)
+					fprintf( stderr, "%d refinement stages finished\n", nstages );
 			}
 		}
 
@@ -1,4 +1,5 @@
 #include "BSPTree.h"
+#include "Frustum.h"
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -207,6 +208,25 @@ void BSPTreeNode::build(list<Geometry*>& objs, int depth) {
 	}
 }
 
+void BSPTreeNode::cull(const Frustum& f, vector<SceneCell>& cells) const {
+	int i;
+	if(!f.overlaps(box)) {
+		return;
+	}
+	if(type == BSP_LEAF) {
+		if(!objects.empty()) {
+			SceneCell c;
+			c.box = box;
+			c.objects = &objects;
+			cells.push_back(c);
+		}
+		return;
+	}
+	for(i = 0; i < 8; i++) {
+		children[i]->cull(f, cells);
+	}
+}
+
 bool BSPTreeNode::intersect(const ray& r, isect& i, const BSPTreeNode*& next) const {
 	bool have_one = false;
 	typedef list<Geometry*>::const_iterator iter;
@@ -329,4 +349,27 @@ bool BSPTree::intersect(const ray& r, isect &i) const {
 	}
 	i.t += tmin;
 	return true;
+}
+
+bool BSPTree::intersect(const Geometry *obj, const ray& r, isect &i) const {
+	double tmin, tmax;
+	ray rr(r);
+	if(!root->box.intersect(r, tmin, tmax) || tmax <= -RAY_EPSILON) {
+		return false;
+	}
+	if(!root->isIn(r.getPosition())) {
+		rr = ray(r.at(tmin), r.getDirection());
+	}
+	else {
+		tmin = 0;
+	}
+	if(!obj->intersect(rr, i)) {
+		return false;
+	}
+	i.t += tmin;
+	return true;
+}
+
+void BSPTree::cull(const Frustum& f, vector<SceneCell>& cells) const {
+	root->cull(f, cells);
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 using std::list;
 
 class BSPTree;
+class Frustum;
 
 /*
  * children:
@@ -56,6 +57,7 @@ class BSPTreeNode {
 		const BSPTreeNode* locate(vec3f p, vec3f d) const;
 		const BSPTreeNode* locate(vec3f p, vec3f d, int face) const;
 		void build(list<Geometry*>& objs, int depth);
+		void cull(const Frustum& f, vector<SceneCell>& cells) const;
 
 		bool isIn(vec3f p) const;
 
@@ -79,6 +81,12 @@ class BSPTree {
 
 		void build();
 		bool intersect(const ray &r, isect& i) const;
+		// intersect() with only obj in the tree, which has to be one of its
+		// objects: the ray starts where it enters the tree, as it does there
+		bool intersect(const Geometry *obj, const ray &r, isect& i) const;
+		// Add every leaf with objects that a ray of f could go through to
+		// cells.  Subtrees outside f are passed over whole.
+		void cull(const Frustum& f, vector<SceneCell>& cells) const;
 
 	protected:
 		BSPTreeNode* root;
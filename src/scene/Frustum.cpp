@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <cfloat>
+
+#include "Frustum.h"
+#include "scene.h"
+
+Frustum::Frustum( const vec3f& eye, const vec3f corner[4] )
+	: eye( eye )
+{
+	vec3f middle = corner[0] + corner[1] + corner[2] + corner[3];
+	for( int k = 0; k < 4; ++k )
+		normal[k] = corner[k].cross( corner[(k + 1) % 4] );
+	if( normal[0].dot( middle ) < 0.0 )
+		for( int k = 0; k < 4; ++k )
+			normal[k] = -normal[k];
+
+	// Every ray of the frustum goes along a positive multiple of a point
+	// between the corners, whose coordinates are within theirs.
+	low = minimum( minimum( corner[0], corner[1] ), minimum( corner[2], corner[3] ) );
+	high = maximum( maximum( corner[0], corner[1] ), maximum( corner[2], corner[3] ) );
+}
+
+// Narrow the range [from, to] of s to where c + k * s <= 0.  False if none
+// of it is left.
+static bool clip( double c, double k, double& from, double& to )
+{
+	if( k > 0.0 )
+		to = std::min( to, -c / k );
+	else if( k < 0.0 )
+		from = std::max( from, -c / k );
+	else if( c > 0.0 )
+		return false;
+	return from <= to;
+}
+
+// b is outside a plane if even its corner farthest in along the normal is
+// outside.
+bool Frustum::overlaps( const BoundingBox& b ) const
+{
+	for( int k = 0; k < 4; ++k ) {
+		const vec3f& n = normal[k];
+		vec3f farthest( n[0] >= 0.0 ? b.max[0] + RAY_EPSILON : b.min[0] - RAY_EPSILON,
+						n[1] >= 0.0 ? b.max[1] + RAY_EPSILON : b.min[1] - RAY_EPSILON,
+						n[2] >= 0.0 ? b.max[2] + RAY_EPSILON : b.min[2] - RAY_EPSILON );
+		if( n.dot( farthest - eye ) < 0.0 )
+			return false;
+	}
+
+	// eye + s * d is in the slab of axis a for some d between low and high
+	// when eye + s * low <= max and eye + s * high >= min
+	double from = 0.0, to = DBL_MAX;
+	for( int a = 0; a < 3; ++a ) {
+		if( !clip( eye[a] - (b.max[a] + RAY_EPSILON), low[a], from, to )
+			|| !clip( (b.min[a] - RAY_EPSILON) - eye[a], -high[a], from, to ) )
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,37 @@
+#ifndef __FRUSTUM_H__
+#define __FRUSTUM_H__
+
+// The rays from one point that pass between four corner rays, such as the
+// camera rays of a tile of pixels.  It is bounded by the four planes
+// through the point and two neighbouring corners, and a box entirely
+// outside one of them is missed by every ray in it.
+//
+// A box can also be missed without being outside any one plane, past a
+// corner of the frustum.  For those every ray is taken through the box's
+// slabs at once, with each coordinate of the direction an interval
+// spanning the corners': if the distances at which the rays could be
+// inside the three slabs don't overlap, no ray is inside all three.
+
+#include "ray.h"
+
+class BoundingBox;
+
+class Frustum
+{
+public:
+	// corner holds the directions of the corner rays from eye, in order
+	// around the edge either way
+	Frustum( const vec3f& eye, const vec3f corner[4] );
+
+	// Could a ray of the frustum go through b?  True for some boxes
+	// near an edge that no ray meets, but never false for one that a ray
+	// does, within RAY_EPSILON.
+	bool overlaps( const BoundingBox& b ) const;
+
+private:
+	vec3f eye;
+	vec3f normal[4];			// of the side planes, pointing in
+	vec3f low, high;			// the least and most of the corners' coordinates
+};
+
+#endif // __FRUSTUM_H__
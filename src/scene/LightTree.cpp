@@ -0,0 +1,238 @@
+#include <cmath>
+#include <algorithm>
+
+#include "LightTree.h"
+#include "light.h"
+#include "../Sampler.h"
+
+// Orders lights along one axis of their positions, for the median split.
+struct LightAxisLess
+{
+	const vector<vec3f> *pos;
+	int axis;
+	bool operator()( int a, int b ) const { return (*pos)[a][axis] < (*pos)[b][axis]; }
+};
+
+static bool sceneOrder( const LightPick& a, const LightPick& b )
+{
+	return a.index < b.index;
+}
+
+static thread_local vector<int> light_stack;
+
+LightTree::LightTree( Scene *scene )
+	: scene( scene )
+{
+}
+
+void LightTree::build()
+{
+	nodes.clear();
+	lights.clear();
+	index.clear();
+	others.clear();
+
+	int k = 0;
+	for( Scene::cliter l = scene->beginLights(); l != scene->endLights(); ++l, ++k ) {
+		if( dynamic_cast<const PointLight*>(*l) ) {
+			lights.push_back( *l );
+			index.push_back( k );
+		} else {
+			LightPick p = { *l, k, 1.0 };
+			others.push_back( p );
+		}
+	}
+	if( !lights.empty() ) {
+		nodes.reserve( 2 * lights.size() - 1 );
+		build( 0, (int)lights.size() );
+	}
+}
+
+// Build the node over lights[begin, end), splitting at the median of the
+// widest axis of their positions, and return its place in nodes.
+int LightTree::build( int begin, int end )
+{
+	int n = (int)nodes.size();
+	nodes.push_back( LightNode() );
+
+	LightNode node;
+	node.brightest = 0.0;
+	node.power = 0.0;
+	node.spot = true;
+	node.left = node.right = node.light = -1;
+	vec3f dirs( 0.0, 0.0, 0.0 );
+
+	for( int k = begin; k < end; ++k ) {
+		const PointLight *l = (const PointLight*)lights[k];
+		const SpotLight *s = dynamic_cast<const SpotLight*>(l);
+		if( k == begin ) {
+			node.box.min = node.box.max = l->position;
+			node.coeff = l->atten_coeff;
+		} else {
+			node.box.min = minimum( node.box.min, l->position );
+			node.box.max = maximum( node.box.max, l->position );
+			node.coeff = minimum( node.coeff, l->atten_coeff );
+		}
+		double c = max( l->color[0], max( l->color[1], l->color[2] ) );
+		node.brightest = max( node.brightest, c );
+		node.power += c;
+		if( s ) {
+			dirs += s->direction;
+		} else {
+			node.spot = false;
+		}
+	}
+
+	// spot lights pointing every way have no cone worth testing
+	node.spot = node.spot && dirs.length() > RAY_EPSILON;
+	node.spread = 0.0;
+	if( node.spot ) {
+		node.axis = dirs.normalize();
+		for( int k = begin; k < end; ++k ) {
+			const SpotLight *s = (const SpotLight*)lights[k];
+			double c = max( -1.0, min( 1.0, node.axis.dot( s->direction ) ) );
+			node.spread = max( node.spread, acos( c ) );
+		}
+	}
+
+	if( end - begin == 1 ) {
+		node.light = begin;
+	} else {
+		vec3f extent = node.box.max - node.box.min;
+		int axis = 0;
+		if( extent[1] > extent[axis] ) axis = 1;
+		if( extent[2] > extent[axis] ) axis = 2;
+
+		// sort a permutation, then lights and index by it
+		vector<vec3f> pos;
+		vector<int> perm;
+		for( int k = begin; k < end; ++k ) {
+			pos.push_back( ((const PointLight*)lights[k])->position );
+			perm.push_back( k - begin );
+		}
+		int mid = (end - begin) / 2;
+		LightAxisLess less = { &pos, axis };
+		std::nth_element( perm.begin(), perm.begin() + mid, perm.end(), less );
+
+		vector<const Light*> l( lights.begin() + begin, lights.begin() + end );
+		vector<int> i( index.begin() + begin, index.begin() + end );
+		for( int k = 0; k < end - begin; ++k ) {
+			lights[begin + k] = l[perm[k]];
+			index[begin + k] = i[perm[k]];
+		}
+
+		node.left = build( begin, begin + mid );
+		node.right = build( begin + mid, end );
+	}
+
+	nodes[n] = node;
+	return n;
+}
+
+// The most distanceAttenuation of any light under node can be at P: at the
+// nearest point of the box with the weakest coefficients, or nothing if P
+// is outside every spot light's cone.
+double LightTree::reach( const LightNode& node, const vec3f& P, double scale ) const
+{
+	vec3f closest = minimum( maximum( P, node.box.min ), node.box.max );
+	// the lights measure their distance in floats
+	double d = (P - closest).length() * (1.0 - 1e-6);
+	double atten = min( 1.0, scale / node.coeff.dot( vec3f( 1.0, d, d * d ) ) );
+
+	if( node.spot ) {
+		vec3f c = (node.box.min + node.box.max) * 0.5;
+		double r = (node.box.max - c).length();
+		vec3f v = P - c;
+		double dist = v.length();
+		if( dist > r ) {
+			// the smallest angle between a light's direction and P from it
+			double angle = acos( max( -1.0, min( 1.0, node.axis.dot( v ) / dist ) ) )
+				- node.spread - asin( r / dist );
+			if( angle > 0.0 && cos( angle ) < cosf( SpotLight::cutoff ) - 2 * RAY_EPSILON ) {
+				return 0.0;
+			}
+		}
+	}
+	return atten;
+}
+
+void LightTree::cull( const vec3f& P, double k, double threshold, vector<LightPick>& picks ) const
+{
+	picks.assign( others.begin(), others.end() );
+	if( nodes.empty() ) {
+		return;
+	}
+
+	double scale = scene->getScaleFactor();
+	vector<int>& stack = light_stack;
+	stack.clear();
+	stack.push_back( 0 );
+	while( !stack.empty() ) {
+		const LightNode& node = nodes[stack.back()];
+		stack.pop_back();
+		if( node.brightest * reach( node, P, scale ) * k <= threshold ) {
+			continue;
+		}
+		if( node.light >= 0 ) {
+			LightPick p = { lights[node.light], index[node.light], 1.0 };
+			picks.push_back( p );
+		} else {
+			stack.push_back( node.right );
+			stack.push_back( node.left );
+		}
+	}
+
+	// shade() sums in the scene's order, whatever the tree's is
+	std::sort( picks.begin(), picks.end(), sceneOrder );
+}
+
+void LightTree::sample( const vec3f& P, double k, double threshold, int n, Rng& rng,
+						vector<LightPick>& picks ) const
+{
+	picks.assign( others.begin(), others.end() );
+	if( nodes.empty() ) {
+		return;
+	}
+
+	// Walk down taking each child with a chance in proportion to its
+	// importance, the total power of its lights times their reach.  Every
+	// light whose cluster can add more than threshold can be reached, so
+	// dividing by the chance of the walk makes each pick's expected weight
+	// its share of the sum.
+	double scale = scene->getScaleFactor();
+	if( nodes[0].brightest * reach( nodes[0], P, scale ) * k <= threshold ) {
+		return;
+	}
+	for( int s = 0; s < n; ++s ) {
+		const LightNode *node = &nodes[0];
+		double pdf = 1.0;
+		double u = rng.uniform();
+		while( node->light < 0 ) {
+			const LightNode& l = nodes[node->left];
+			const LightNode& r = nodes[node->right];
+			double al = reach( l, P, scale );
+			double ar = reach( r, P, scale );
+			double il = l.brightest * al * k > threshold ? l.power * al : 0.0;
+			double ir = r.brightest * ar * k > threshold ? r.power * ar : 0.0;
+			if( il + ir <= 0.0 ) {
+				node = NULL;
+				break;
+			}
+			double p = il / (il + ir);
+			if( u < p ) {
+				u /= p;
+				pdf *= p;
+				node = &l;
+			} else {
+				u = (u - p) / (1.0 - p);
+				pdf *= 1.0 - p;
+				node = &r;
+			}
+			u = min( u, 1.0 - 1e-12 );
+		}
+		if( node ) {
+			LightPick p = { lights[node->light], index[node->light], 1.0 / (n * pdf) };
+			picks.push_back( p );
+		}
+	}
+}
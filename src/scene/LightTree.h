@@ -0,0 +1,78 @@
+#ifndef __LIGHTTREE_H__
+#define __LIGHTTREE_H__
+
+// A bounding volume hierarchy over the scene's point and spot lights.
+//
+// Every node keeps the box around its lights' positions, the brightest of
+// them and their total, the smallest of their distance attenuation
+// coefficients and, if they are all spot lights, a cone around their
+// directions.  That is enough to bound what any light under the node can
+// add at a point without visiting the lights, so a cluster that is too far
+// away or points the other way is dropped in one step.  The same bounds
+// guide a walk down the tree that picks one light at random, each light
+// about in proportion to what it can add.
+//
+// Directional lights are as close to every point as each other and stay
+// out of the tree.
+
+#include <vector>
+
+#include "scene.h"
+
+using std::vector;
+
+class Light;
+class Rng;
+
+// A light for shade() to evaluate, and the weight of its contribution.
+struct LightPick
+{
+	const Light *light;
+	int index;				// in the scene's light list
+	double weight;			// 1, or 1/(samples * probability) for a random pick
+};
+
+struct LightNode
+{
+	BoundingBox box;		// around the lights' positions
+	double brightest;		// the largest color component of any light
+	double power;			// the sum of those
+	vec3f coeff;			// the smallest of each attenuation coefficient
+	bool spot;				// only spot lights, with a cone:
+	vec3f axis;				// every direction is within
+	double spread;			// spread radians of axis
+	int left, right;		// children, or -1 in a leaf
+	int light;				// in a leaf, the light
+};
+
+class LightTree
+{
+public:
+	LightTree( Scene *scene );
+
+	void build();
+
+	// Every light that might add more than threshold at P to a surface
+	// that passes at most k of the light on, in the scene's light order.
+	void cull( const vec3f& P, double k, double threshold, vector<LightPick>& picks ) const;
+
+	// The directional lights, and n lights drawn from the tree by their
+	// bounds at P, weighted so that the sum over the picks is on average
+	// the sum over everything cull() returns.
+	void sample( const vec3f& P, double k, double threshold, int n, Rng& rng,
+				 vector<LightPick>& picks ) const;
+
+	int size() const { return (int)lights.size(); }
+
+private:
+	int build( int begin, int end );
+	double reach( const LightNode& node, const vec3f& P, double scale ) const;
+
+	Scene *scene;
+	vector<LightNode> nodes;
+	vector<const Light*> lights;	// in the tree
+	vector<int> index;				// their places in the scene's list
+	vector<LightPick> others;		// the directional lights
+};
+
+#endif // __LIGHTTREE_H__
@@ -0,0 +1,152 @@
+#include <cmath>
+#include <cfloat>
+
+#include "ShadowMap.h"
+#include "scene.h"
+
+ShadowMap::ShadowMap( ShadowProjection projection, int size, const vec3f& origin,
+					  const vec3f& axis, double halfAngle, double extent, double range )
+	: projection( projection ), size( size ), origin( origin ), range( range )
+{
+	faces = projection == SHADOW_CUBE ? 6 : 1;
+	this->axis = axis.normalize();
+	vec3f e = fabs( this->axis[0] ) < 0.9 ? vec3f( 1.0, 0.0, 0.0 ) : vec3f( 0.0, 1.0, 0.0 );
+	u = this->axis.cross( e ).normalize();
+	v = this->axis.cross( u );
+	scale = projection == SHADOW_ORTHOGRAPHIC ? extent : tan( halfAngle );
+	depth.assign( (size_t)faces * size * size, FLT_MAX );
+}
+
+// The ray through the point (x, y) of a face, in texels from its corner.
+// A cube face k looks along + or - the k/2'th axis.
+ray ShadowMap::texelRay( int face, double x, double y ) const
+{
+	double a = 2.0 * x / size - 1.0;
+	double b = 2.0 * y / size - 1.0;
+
+	switch( projection ) {
+	case SHADOW_CUBE:
+		{
+			int k = face / 2;
+			vec3f d( 0.0, 0.0, 0.0 );
+			d[k] = (face & 1) ? -1.0 : 1.0;
+			d[(k + 1) % 3] = a;
+			d[(k + 2) % 3] = b;
+			return ray( origin, d.normalize() );
+		}
+	case SHADOW_PERSPECTIVE:
+		return ray( origin, (axis + u * (a * scale) + v * (b * scale)).normalize() );
+	default:
+		return ray( origin + u * (a * scale) + v * (b * scale), axis );
+	}
+}
+
+// Every texel of the row keeps the distance to the first opaque object
+// its ray meets within range.  Transparent objects are passed through.
+void ShadowMap::renderRow( const Scene *scene, int row )
+{
+	int face = row / size;
+	int y = row % size;
+	float *out = &depth[((size_t)face * size + y) * size];
+
+	for( int x = 0; x < size; ++x ) {
+		ray r = texelRay( face, x + 0.5, y + 0.5 );
+		vec3f d = r.getDirection();
+		double travelled = 0.0;
+		isect i;
+		while( scene->intersect( r, i ) ) {
+			travelled += i.t;
+			if( travelled > range - RAY_EPSILON )
+				break;
+			if( i.getMaterial().kt.clamp().iszero() ) {
+				out[x] = (float)travelled;
+				break;
+			}
+			r = ray( r.at( i.t ), d );
+		}
+	}
+}
+
+// Where P falls on the map: the face, the texel coordinates, its distance
+// along the map's rays and about how wide a texel is there.  False if the
+// map doesn't cover P.
+bool ShadowMap::project( const vec3f& P, int& face, double& x, double& y, double& d, double& texel ) const
+{
+	vec3f w = P - origin;
+	double a, b;
+
+	switch( projection ) {
+	case SHADOW_CUBE:
+		{
+			int k = 0;
+			if( fabs( w[1] ) > fabs( w[k] ) ) k = 1;
+			if( fabs( w[2] ) > fabs( w[k] ) ) k = 2;
+			double m = fabs( w[k] );
+			if( m <= 0.0 )
+				return false;
+			face = 2 * k + (w[k] < 0.0 ? 1 : 0);
+			a = w[(k + 1) % 3] / m;
+			b = w[(k + 2) % 3] / m;
+			d = w.length();
+			texel = d * 2.0 / size;
+			break;
+		}
+	case SHADOW_PERSPECTIVE:
+		{
+			double z = w.dot( axis );
+			if( z <= 0.0 )
+				return false;
+			face = 0;
+			a = w.dot( u ) / (z * scale);
+			b = w.dot( v ) / (z * scale);
+			d = w.length();
+			texel = d * 2.0 * scale / size;
+			break;
+		}
+	default:
+		face = 0;
+		a = w.dot( u ) / scale;
+		b = w.dot( v ) / scale;
+		d = w.dot( axis );
+		texel = 2.0 * scale / size;
+		break;
+	}
+
+	if( a < -1.0 || a > 1.0 || b < -1.0 || b > 1.0 )
+		return false;
+	x = (a + 1.0) * 0.5 * size;
+	y = (b + 1.0) * 0.5 * size;
+	return true;
+}
+
+double ShadowMap::depthAt( int face, int x, int y ) const
+{
+	x = x < 0 ? 0 : (x >= size ? size - 1 : x);
+	y = y < 0 ? 0 : (y >= size ? size - 1 : y);
+	return depth[((size_t)face * size + y) * size + x];
+}
+
+// Percentage closer filtering: the four texels around P are each tested
+// and the results blended by how close P is to them.  The bias of two
+// texels keeps a surface from shadowing itself unless it is nearly edge on
+// to the light.
+double ShadowMap::visibility( const vec3f& P ) const
+{
+	int face;
+	double x, y, d, texel;
+	if( !project( P, face, x, y, d, texel ) )
+		return 1.0;
+
+	double bias = 2.0 * texel;
+	double fx = x - 0.5, fy = y - 0.5;
+	int x0 = (int)floor( fx ), y0 = (int)floor( fy );
+	double tx = fx - x0, ty = fy - y0;
+
+	double lit00 = d <= depthAt( face, x0, y0 ) + bias ? 1.0 : 0.0;
+	double lit10 = d <= depthAt( face, x0 + 1, y0 ) + bias ? 1.0 : 0.0;
+	double lit01 = d <= depthAt( face, x0, y0 + 1 ) + bias ? 1.0 : 0.0;
+	double lit11 = d <= depthAt( face, x0 + 1, y0 + 1 ) + bias ? 1.0 : 0.0;
+
+	return (lit00 * (1.0 - tx) + lit10 * tx) * (1.0 - ty)
+		+ (lit01 * (1.0 - tx) + lit11 * tx) * ty;
+}
@@ -0,0 +1,62 @@
+#ifndef __SHADOWMAP_H__
+#define __SHADOWMAP_H__
+
+// A depth map of the scene seen from a light, for the approximate shadows
+// of quick previews.
+//
+// Each texel holds how far a ray from the light gets before it hits an
+// opaque object.  A point is lit if it is no farther from the light than
+// that, so one lookup replaces a shadow ray.  Four texels are compared and
+// blended for soft edges.  Transparent objects cast no shadow in the map,
+// and the resolution limits how small a shadow can be.
+//
+// Point lights use a cube of six square maps, spot lights one perspective
+// map over their cone and directional lights an orthographic map over the
+// scene's bounds.
+
+#include <vector>
+
+#include "ray.h"
+
+using std::vector;
+
+class Scene;
+
+enum ShadowProjection {
+	SHADOW_CUBE = 0,
+	SHADOW_PERSPECTIVE,
+	SHADOW_ORTHOGRAPHIC
+};
+
+class ShadowMap
+{
+public:
+	// size x size texels on each face.  For SHADOW_CUBE and
+	// SHADOW_PERSPECTIVE the rays leave from origin; a perspective map
+	// covers halfAngle radians around axis.  An orthographic map covers a
+	// square extent wide on each side of origin, looking along axis.
+	// Objects farther than range along a texel's ray cast no shadow.
+	ShadowMap( ShadowProjection projection, int size, const vec3f& origin,
+			   const vec3f& axis, double halfAngle, double extent, double range );
+
+	// The map is filled in by rows so it can be split over threads.
+	int rows() const { return faces * size; }
+	void renderRow( const Scene *scene, int row );
+
+	// How much of the light reaches P, from 0 to 1.
+	double visibility( const vec3f& P ) const;
+
+private:
+	ray texelRay( int face, double x, double y ) const;
+	bool project( const vec3f& P, int& face, double& x, double& y, double& depth, double& texel ) const;
+	double depthAt( int face, int x, int y ) const;
+
+	ShadowProjection projection;
+	int size, faces;
+	vec3f origin, axis, u, v;
+	double scale;				// tan(halfAngle), or the extent
+	double range;
+	vector<float> depth;
+};
+
+#endif // __SHADOWMAP_H__
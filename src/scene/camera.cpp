@@ -12,6 +12,7 @@ Camera::Camera()
     u = vec3f( 1,0,0 );
     v = vec3f( 0,1,0 );
     look = vec3f( 0,0,-1 );
+    updateWindow();
 }
 
 void
@@ -25,6 +26,19 @@ Camera::rayThrough( double x, double y, ray &r )
     r = ray( eye, dir.normalize() );
 }
 
+bool
+Camera::project( const vec3f& P, double& x, double& y ) const
+// P - eye is s * (look + (x - .5) * u + (y - .5) * v) for some s,
+// which has to be positive.
+{
+    vec3f w = toWindow * (P - eye);
+    if( !(w[0] > 0.0) )
+        return false;
+    x = w[1] / w[0] + 0.5;
+    y = w[2] / w[0] + 0.5;
+    return true;
+}
+
 void
 Camera::setEye( const vec3f &eye )
 {
@@ -89,8 +103,13 @@ Camera::update()
     u = m * vec3f( 1,0,0 ) * normalizedHeight*aspectRatio;
     v = m * vec3f( 0,1,0 ) * normalizedHeight;
     look = m * vec3f( 0,0,-1 );
+    updateWindow();
 }
 
-
-
-
+void
+Camera::updateWindow()
+{
+    // setLook takes the up vector as it comes, so u and v aren't always
+    // square to look
+    toWindow = mat3f( look, u, v ).transpose().inverse();
+}
@@ -16,16 +16,25 @@ public:
 
     double getAspectRatio() { return aspectRatio; }
 	void getUVL(vec3f& uu, vec3f& vv, vec3f& ll) const {uu = u; vv = v; ll = look;}
+	// does rayThrough give the same rays as c's?
+	bool sameView( const Camera& c ) const
+	{ return eye == c.eye && look == c.look && u == c.u && v == c.v; }
+	const vec3f& getEye() const { return eye; }
+	// The normalized window point whose rayThrough goes through P, or false
+	// if P isn't in front of the eye.
+	bool project( const vec3f& P, double& x, double& y ) const;
 private:
     mat3f m;                     // rotation matrix
     double normalizedHeight;    // dimensions of image place at unit dist from eye
     double aspectRatio;
     
     void update();              // using the above three values calculate look,u,v
+    void updateWindow();        // and from those toWindow
     
     vec3f eye;
     vec3f look;                  // direction to look
     vec3f u,v;                   // u and v in the 
+    mat3f toWindow;              // takes look + x*u + y*v to (1,x,y)
 };
 
 #endif
@@ -0,0 +1,155 @@
+#include <cmath>
+#include <string.h>
+
+#include "envmap.h"
+#include "camera.h"
+
+#define PI 3.14159265359
+
+// Cube faces are indexed by major axis and sign in the camera frame
+// (a = along look, b = along right, c = along up):
+// 0: +a, 1: -a, 2: +b, 3: -b, 4: +c, 5: -c.
+// Face coordinates (s,t) run over [-1,1].
+static void faceToDir( int face, double s, double t, double& a, double& b, double& c )
+{
+	switch( face ) {
+	case 0: a =  1; b =  s; c =  t; break;
+	case 1: a = -1; b = -s; c =  t; break;
+	case 2: a = -s; b =  1; c =  t; break;
+	case 3: a =  s; b = -1; c =  t; break;
+	case 4: a = -t; b =  s; c =  1; break;
+	default: a =  t; b =  s; c = -1; break;
+	}
+}
+
+EnvironmentMap::EnvironmentMap()
+	: faces( NULL ), res( 0 ), look( 0, 0, -1 ), up( 0, 1, 0 ), right( 1, 0, 0 )
+{
+}
+
+EnvironmentMap::~EnvironmentMap()
+{
+	clear();
+}
+
+void EnvironmentMap::clear()
+{
+	delete [] faces;
+	faces = NULL;
+	res = 0;
+}
+
+void EnvironmentMap::setBasis( const Camera *camera )
+{
+	vec3f u, v, l;
+	camera->getUVL( u, v, l );
+	look = l.normalize();
+	right = u.normalize();
+	up = v.normalize();
+}
+
+// Bilinear sample of the latitude-longitude image in direction (a,b,c).
+// This is the only place that pays for atan2/acos, once per cube texel.
+void EnvironmentMap::sampleLatLong( const unsigned char *img, int width, int height,
+									double a, double b, double c, float *out ) const
+{
+	double len = sqrt( a * a + b * b + c * c );
+	double u = (atan2( b, a ) + PI) / (2 * PI);
+	double v = acos( maximum( -1.0, minimum( 1.0, c / len ) ) ) / PI;
+
+	// texel centers; rows are stored bottom up with the pole v = 0 on top
+	double x = u * width - 0.5;
+	double y = (1.0 - v) * height - 0.5;
+	int x0 = (int)floor( x ), y0 = (int)floor( y );
+	double fx = x - x0, fy = y - y0;
+
+	for( int k = 0; k < 3; ++k )
+		out[k] = 0.0f;
+
+	for( int dy = 0; dy < 2; ++dy ) {
+		// clamp at the poles, wrap around in longitude
+		int ty = y0 + dy;
+		ty = ty < 0 ? 0 : (ty >= height ? height - 1 : ty);
+		double wy = dy ? fy : 1.0 - fy;
+		for( int dx = 0; dx < 2; ++dx ) {
+			int tx = ((x0 + dx) % width + width) % width;
+			double w = wy * (dx ? fx : 1.0 - fx);
+			const unsigned char *p = img + 3 * ((size_t)ty * width + tx);
+			for( int k = 0; k < 3; ++k )
+				out[k] += (float)(w * p[k] / 255.0);
+		}
+	}
+}
+
+void EnvironmentMap::build( const unsigned char *img, int width, int height )
+{
+	clear();
+	if( !img || width <= 0 || height <= 0 )
+		return;
+
+	// a quarter of the image width per face keeps roughly the source resolution
+	res = width / 4;
+	if( res < 8 )
+		res = 8;
+	faces = new float[ 6 * res * res * 3 ];
+
+	for( int f = 0; f < 6; ++f ) {
+		for( int j = 0; j < res; ++j ) {
+			for( int i = 0; i < res; ++i ) {
+				double s = 2.0 * (i + 0.5) / res - 1.0;
+				double t = 2.0 * (j + 0.5) / res - 1.0;
+				double a, b, c;
+				faceToDir( f, s, t, a, b, c );
+				sampleLatLong( img, width, height, a, b, c,
+							   faces + 3 * (((size_t)f * res + j) * res + i) );
+			}
+		}
+	}
+}
+
+// Bilinear fetch inside one face, clamped at the face border.
+vec3f EnvironmentMap::fetch( int face, double s, double t ) const
+{
+	double x = (s + 1.0) * 0.5 * res - 0.5;
+	double y = (t + 1.0) * 0.5 * res - 0.5;
+	x = maximum( 0.0, minimum( x, res - 1.0 ) );
+	y = maximum( 0.0, minimum( y, res - 1.0 ) );
+
+	int x0 = (int)x, y0 = (int)y;
+	int x1 = x0 + 1 < res ? x0 + 1 : x0;
+	int y1 = y0 + 1 < res ? y0 + 1 : y0;
+	double fx = x - x0, fy = y - y0;
+
+	const float *base = faces + (size_t)face * res * res * 3;
+	const float *p00 = base + 3 * (y0 * res + x0);
+	const float *p10 = base + 3 * (y0 * res + x1);
+	const float *p01 = base + 3 * (y1 * res + x0);
+	const float *p11 = base + 3 * (y1 * res + x1);
+
+	vec3f col;
+	for( int k = 0; k < 3; ++k ) {
+		col[k] = (1 - fy) * ((1 - fx) * p00[k] + fx * p10[k])
+				+ fy * ((1 - fx) * p01[k] + fx * p11[k]);
+	}
+	return col;
+}
+
+vec3f EnvironmentMap::lookup( const vec3f& d ) const
+{
+	if( !faces )
+		return vec3f( 0.0, 0.0, 0.0 );
+
+	double a = look.dot( d ), b = right.dot( d ), c = up.dot( d );
+	double fa = fabs( a ), fb = fabs( b ), fc = fabs( c );
+
+	// invert faceToDir for the major axis
+	if( fa >= fb && fa >= fc ) {
+		return a > 0 ? fetch( 0, b / fa, c / fa ) : fetch( 1, -b / fa, c / fa );
+	}
+	else if( fb >= fc ) {
+		return b > 0 ? fetch( 2, -a / fb, c / fb ) : fetch( 3, a / fb, c / fb );
+	}
+	else {
+		return c > 0 ? fetch( 4, b / fc, -a / fc ) : fetch( 5, b / fc, a / fc );
+	}
+}
@@ -0,0 +1,47 @@
+//
+// envmap.h
+//
+// The EnvironmentMap class: the background image resampled once into a
+// float cube map, so that rays leaving the scene can be colored without
+// any trigonometry.
+//
+
+#ifndef __ENVMAP_H__
+#define __ENVMAP_H__
+
+#include "../vecmath/vecmath.h"
+
+class Camera;
+
+class EnvironmentMap
+{
+public:
+	EnvironmentMap();
+	~EnvironmentMap();
+
+	// Resample a latitude-longitude image (R,G,B bytes, bottom row first,
+	// as returned by readBMP) into the six cube faces.
+	void build( const unsigned char *img, int width, int height );
+	void clear();
+	bool loaded() const { return faces != NULL; }
+
+	// The sphere is attached to the camera: longitude is measured around
+	// the up vector from the look direction.  The orthonormal basis is
+	// cached here so that lookups only need three dot products.
+	void setBasis( const Camera *camera );
+
+	// Bilinearly filtered color seen along world space direction d.
+	vec3f lookup( const vec3f& d ) const;
+
+private:
+	void sampleLatLong( const unsigned char *img, int width, int height,
+						double a, double b, double c, float *out ) const;
+	vec3f fetch( int face, double s, double t ) const;
+
+	float *faces;			// 6 faces of res x res float RGB texels
+	int res;
+
+	vec3f look, up, right;
+};
+
+#endif // __ENVMAP_H__
@@ -1,9 +1,88 @@
 #include <cmath>
 
 #include "light.h"
+#include "ShadowMap.h"
 int Light::spotP=128;
 float Light::cutoff=0.2;
 
+Light::~Light()
+{
+	delete shadowMap;
+}
+
+void Light::setShadowMap( ShadowMap *map )
+{
+	delete shadowMap;
+	shadowMap = map;
+}
+
+// The last opaque object each thread found between a point and a light,
+// tried before the octree on the next shadow ray to that light.  Shadow
+// rays from neighbouring points are usually stopped by the same object.
+// An entry is only good for the scene it was made in, so a light or an
+// object freed with an old scene is never looked at.
+#define OCCLUDER_CACHE_SIZE (64)
+
+struct Occluder
+{
+	const Light *light;
+	const SceneObject *object;
+	unsigned int serial;
+};
+
+static thread_local Occluder occluders[OCCLUDER_CACHE_SIZE];
+
+static Occluder& occluderSlot( const Light *light )
+{
+	return occluders[((size_t)light / sizeof(void*)) % OCCLUDER_CACHE_SIZE];
+}
+
+// Does this thread's last occluder for light stop r before it has gone
+// reach?  The margin keeps hits near the light, which the full walk might
+// count either way, out of it.
+static bool occludedByCache( const Light *light, const Scene *scene, const ray& r, double reach )
+{
+	const Occluder& o = occluderSlot(light);
+	if(o.light != light || o.serial != scene->getSerial() || !o.object) {
+		return false;
+	}
+	isect i;
+	return o.object->intersect(r, i) && i.t < reach - 2 * RAY_EPSILON
+		&& i.getMaterial().kt.clamp().iszero();
+}
+
+static void rememberOccluder( const Light *light, const Scene *scene, const isect& i )
+{
+	if(i.obj && i.getMaterial().kt.clamp().iszero()) {
+		Occluder& o = occluderSlot(light);
+		o.light = light;
+		o.object = i.obj;
+		o.serial = scene->getSerial();
+	}
+}
+
+void Light::sample( const vec3f& P, LightSample& s ) const
+{
+	s.P = P;
+	s.direction = getDirection(P);
+	s.distance = 1.0e308;
+	s.attenuation = distanceAttenuation(P);
+	s.falloff = 1.0;
+	s.color = unoccludedAttenuation(P);
+	s.reach = 1.0e308;
+}
+
+void DirectionalLight::sample( const vec3f& P, LightSample& s ) const
+{
+	s.P = P;
+	s.direction = -orientation;
+	s.distance = 1.0e308;
+	s.attenuation = 1.0;
+	s.falloff = 1.0;
+	s.color = color;
+	s.reach = 1.0e308;
+}
+
 double DirectionalLight::distanceAttenuation( const vec3f& P ) const
 {
 	// distance to light is infinite, so f(di) goes to 0.  Return 1.
@@ -13,13 +92,27 @@ double DirectionalLight::distanceAttenuation( const vec3f& P ) const
 
 vec3f DirectionalLight::shadowAttenuation( const vec3f& P ) const
 {
-    vec3f d = getDirection(P);
-	vec3f col = getColor(P);
-	ray r(P, d);
+	LightSample s;
+	DirectionalLight::sample(P, s);
+	return DirectionalLight::shadowAttenuation(s);
+}
+
+vec3f DirectionalLight::shadowAttenuation( const LightSample& s ) const
+{
+	if(shadowMap) {
+		return color * shadowMap->visibility(s.P);
+	}
+	const vec3f& d = s.direction;
+	vec3f col = color;
+	ray r(s.P, d);
+	if(occludedByCache(this, scene, r, s.reach)) {
+		return vec3f(0, 0, 0);
+	}
 	isect i;
 	while(scene->intersect(r, i)) {
 		col = col.multiply(i.getMaterial().kt.clamp());
 		if(col.iszero()) {
+			rememberOccluder(this, scene, i);
 			break;
 		}
 		r = ray(r.at(i.t), d);
@@ -38,10 +131,25 @@ vec3f DirectionalLight::getDirection( const vec3f& P ) const
 	return -orientation;
 }
 
+void PointLight::sample( const vec3f& P, LightSample& s ) const
+{
+	vec3f v = position - P;
+	double length = v.length();
+	float distance = length;
+	s.P = P;
+	s.direction = v;
+	s.direction /= length;
+	s.distance = length;
+	s.attenuation = min(1.0, scene->getScaleFactor() / (atten_coeff.dot(vec3f(1, distance, distance * distance))));
+	s.falloff = 1.0;
+	s.color = color;
+	s.reach = min(length, cut_distance);
+}
+
 double PointLight::distanceAttenuation( const vec3f& P ) const
 {
 	float distance = (position - P).length();
-	return min(1.0,  pow(10, scene->getScale()) / (atten_coeff.dot(vec3f(1, distance, distance * distance))));
+	return min(1.0,  scene->getScaleFactor() / (atten_coeff.dot(vec3f(1, distance, distance * distance))));
 }
 
 vec3f PointLight::getColor( const vec3f& P ) const
@@ -58,10 +166,23 @@ vec3f PointLight::getDirection( const vec3f& P ) const
 
 vec3f PointLight::shadowAttenuation(const vec3f& P) const
 {
-    vec3f d = getDirection(P);
-	float dis = min((position - P).length(), cut_distance);
-	vec3f col = getColor(P);
-	ray r(P, d);
+	LightSample s;
+	PointLight::sample(P, s);
+	return PointLight::shadowAttenuation(s);
+}
+
+vec3f PointLight::shadowAttenuation(const LightSample& s) const
+{
+	if(shadowMap) {
+		return color * shadowMap->visibility(s.P);
+	}
+	const vec3f& d = s.direction;
+	float dis = s.reach;
+	vec3f col = color;
+	ray r(s.P, d);
+	if(!col.iszero() && dis >= RAY_EPSILON && occludedByCache(this, scene, r, dis)) {
+		return vec3f(0, 0, 0);
+	}
 	isect i;
 	while(dis >= RAY_EPSILON && !col.iszero() && scene->intersect(r, i)) {
 		dis -= i.t;
@@ -69,18 +190,78 @@ vec3f PointLight::shadowAttenuation(const vec3f& P) const
 			break;
 		}
 		col = col.multiply(i.getMaterial().kt.clamp());
+		if(col.iszero()) {
+			rememberOccluder(this, scene, i);
+		}
 		r = ray(r.at(i.t), d);
 	}
 	return col;
 }
 
 vec3f SpotLight::shadowAttenuation(const vec3f& P) const
+{
+	LightSample s;
+	SpotLight::sample(P, s);
+	return SpotLight::shadowAttenuation(s);
+}
+
+void SpotLight::sample(const vec3f& P, LightSample& s) const
+{
+	PointLight::sample(P, s);
+	float L = direction.dot(-s.direction);
+	if(L <= cosf(cutoff) - RAY_EPSILON) {
+		s.falloff = 0.0;
+		s.color = vec3f(0, 0, 0);
+	}
+	else {
+		s.falloff = pow(L, shiness * spotP);
+		s.color = color * s.falloff;
+	}
+}
+
+vec3f SpotLight::shadowAttenuation(const LightSample& s) const
+{
+	if(s.falloff == 0.0) {
+		return vec3f(0, 0, 0);
+	}
+	return PointLight::shadowAttenuation(s) * s.falloff;
+}
+
+vec3f SpotLight::unoccludedAttenuation(const vec3f& P) const
 {
 	float L = direction.dot(-getDirection(P));
 	if(L <= cosf(cutoff) - RAY_EPSILON) {
 		return vec3f(0, 0, 0);
 	}
-	return PointLight::shadowAttenuation(P) * pow(L, shiness * spotP);
+	return getColor(P) * pow(L, shiness * spotP);
+}
+
+// An orthographic map over the scene's bounds, from outside them.
+ShadowMap* DirectionalLight::makeShadowMap( int size ) const
+{
+	BoundingBox b = scene->getBound();
+	vec3f center = (b.min + b.max) * 0.5;
+	double radius = max((b.max - center).length(), RAY_EPSILON);
+	vec3f axis = orientation.normalize();
+	return new ShadowMap(SHADOW_ORTHOGRAPHIC, size, center - axis * (2 * radius), axis, 0.0, radius, 1.0e308);
+}
+
+// Occluders past cut_distance are left out, as sample() stops the shadow
+// ray there.
+ShadowMap* PointLight::makeShadowMap( int size ) const
+{
+	return new ShadowMap(SHADOW_CUBE, size, position, vec3f(0, 0, 1), 0.0, 0.0, cut_distance);
+}
+
+// A perspective map just wider than the cone, or a cube for a cone too wide
+// to fit one.
+ShadowMap* SpotLight::makeShadowMap( int size ) const
+{
+	double angle = acos(cosf(cutoff)) * 1.05 + 0.01;
+	if(angle > 1.3) {
+		return PointLight::makeShadowMap(size);
+	}
+	return new ShadowMap(SHADOW_PERSPECTIVE, size, position, direction, angle, 0.0, cut_distance);
 }
 
 double AmbientLight::distanceAttenuation( const vec3f& P ) const
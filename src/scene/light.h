@@ -3,23 +3,57 @@
 
 #include "scene.h"
 
+class ShadowMap;
+
+// Everything about one light as seen from one point, worked out together so
+// that the vector to the light is formed and measured only once.
+struct LightSample
+{
+	vec3f P;				// the point
+	vec3f direction;		// toward the light, getDirection(P)
+	double distance;		// to the light, 1e308 for a directional light
+	double attenuation;		// distanceAttenuation(P)
+	double falloff;			// a spot light's cone and fall off, else 1
+	vec3f color;			// unoccludedAttenuation(P)
+	double reach;			// how far the shadow ray has to go
+};
+
 class Light
 	: public SceneElement
 {
 public:
+	virtual ~Light();
+
+	// Fill in s for the point P.  shade() makes this one call per light
+	// instead of one for each of the other queries.
+	virtual void sample(const vec3f& P, LightSample& s) const;
+	// shadowAttenuation(s.P), without working s out again
+	virtual vec3f shadowAttenuation(const LightSample& s) const
+	{ return shadowAttenuation(s.P); }
 	virtual vec3f shadowAttenuation(const vec3f& P) const = 0;
+	// shadowAttenuation(P) were nothing in the way, which it never exceeds
+	virtual vec3f unoccludedAttenuation(const vec3f& P) const { return getColor(P); }
 	virtual double distanceAttenuation( const vec3f& P ) const = 0;
 	virtual vec3f getColor( const vec3f& P ) const = 0;
 	virtual vec3f getDirection( const vec3f& P ) const = 0;
 	static void setSpotP(int p) { spotP = p; }
 	static void setCutoff(double cut) { cutoff = cut; }
+	static float getCutoff() { return cutoff; }
+
+	// A new, empty depth map of size x size texels a face for this light,
+	// or NULL if it can't have one.  Once the light has a map its shadows
+	// are looked up there instead of traced.
+	virtual ShadowMap* makeShadowMap(int) const { return NULL; }
+	void setShadowMap(ShadowMap *map);
+	ShadowMap* getShadowMap() const { return shadowMap; }
 
 protected:
 	Light( Scene *scene, const vec3f& col )
-		: SceneElement( scene ), color( col ) {}
+		: SceneElement( scene ), color( col ), shadowMap( NULL ) {}
 	static int spotP;
 	static float cutoff;
 	vec3f 		color;
+	ShadowMap	*shadowMap;
 };
 
 class DirectionalLight
@@ -28,10 +62,13 @@ class DirectionalLight
 public:
 	DirectionalLight( Scene *scene, const vec3f& orien, const vec3f& color )
 		: Light( scene, color ), orientation( orien ) {}
+	virtual void sample(const vec3f& P, LightSample& s) const;
 	virtual vec3f shadowAttenuation(const vec3f& P) const;
+	virtual vec3f shadowAttenuation(const LightSample& s) const;
 	virtual double distanceAttenuation( const vec3f& P ) const;
 	virtual vec3f getColor( const vec3f& P ) const;
 	virtual vec3f getDirection( const vec3f& P ) const;
+	virtual ShadowMap* makeShadowMap(int size) const;
 
 protected:
 	vec3f 		orientation;
@@ -60,11 +97,15 @@ public:
 				cut_distance = xp;
 			}
 	}
+	virtual void sample(const vec3f& P, LightSample& s) const;
 	virtual vec3f shadowAttenuation(const vec3f& P) const;
+	virtual vec3f shadowAttenuation(const LightSample& s) const;
 	virtual double distanceAttenuation( const vec3f& P ) const;
 	virtual vec3f getColor( const vec3f& P ) const;
 	virtual vec3f getDirection( const vec3f& P ) const;
+	virtual ShadowMap* makeShadowMap(int size) const;
 
+	friend class LightTree;
 protected:
 	vec3f position;
 	vec3f atten_coeff;
@@ -77,7 +118,13 @@ class SpotLight
 public:
 	SpotLight( Scene *scene, const vec3f& pos, const vec3f& color, const vec3f& coeff, const vec3f& direct, float cutoff, float shine )
 		:PointLight(scene, pos, color, coeff ), direction(direct.normalize()), cutoff_ang(cosf(cutoff)), shiness(shine) {}
+	virtual void sample(const vec3f& P, LightSample& s) const;
 	virtual vec3f shadowAttenuation(const vec3f& P) const;
+	virtual vec3f shadowAttenuation(const LightSample& s) const;
+	virtual vec3f unoccludedAttenuation(const vec3f& P) const;
+	virtual ShadowMap* makeShadowMap(int size) const;
+
+	friend class LightTree;
 protected:
 	vec3f direction;
 	float cutoff_ang;
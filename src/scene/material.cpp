@@ -1,6 +1,78 @@
 ﻿#include "ray.h"
 #include "material.h"
 #include "light.h"
+#include "LightTree.h"
+#include "../Sampler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using std::vector;
+
+// One light's part of shade().
+struct LightTerm
+{
+	const Light *light;
+	LightSample sample;		// the light from the hit
+	int index;				// in the scene's light list
+	double NL;				// cosine at the surface
+	double dist;			// distanceAttenuation
+	double RVn;				// specular falloff
+	double bound;			// the most it can add, unshadowed
+	double weight;			// of a light picked at random
+	bool lit;				// shadow traced and diffuse and specular filled in
+	vec3f diffuse, specular;
+};
+
+static thread_local vector<LightTerm> light_terms;
+static thread_local vector<LightTerm*> light_order;
+static thread_local vector<LightPick> light_picks;
+static thread_local Rng light_rng;
+
+// A little over 1, so that a color summed in another order is certainly
+// saturated too.
+static const double SATURATED = 1.0 + 1e-9;
+
+static bool brighter( const LightTerm *a, const LightTerm *b )
+{
+	return a->bound * a->weight > b->bound * b->weight;
+}
+
+// A seed for the light picks at a hit, from the bits of the hit and the
+// ray, so they don't depend on the thread or the order of the pixels.
+static unsigned long long hashHit( const vec3f& P, const vec3f& d )
+{
+	unsigned long long h = 0;
+	for( int k = 0; k < 6; k++ ) {
+		double x = k < 3 ? P[k] : d[k - 3];
+		unsigned long long b;
+		memcpy( &b, &x, sizeof(b) );
+		h = (h ^ b) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 32;
+	}
+	return h;
+}
+
+// Fill in t for light at the hit i on r, except for its shadow.
+void Material::lightTerm( const ray& r, const isect& i, const vec3f& point, const Light *light, LightTerm& t ) const
+{
+	light->sample(point, t.sample);
+	const vec3f& L = t.sample.direction;
+	t.light = light;
+	t.NL = i.N.dot(L);
+	t.dist = t.sample.attenuation;
+	vec3f R = i.N * (2 * t.NL) - L;
+	double RV = max(0.0, -R.dot(r.getDirection()));
+	double n = shininess * 128;
+	t.RVn = pow(RV, n);
+	t.lit = false;
+
+	vec3f trans_loss = vec3f(1.0, 1.0, 1.0) - kt;
+	vec3f atten = t.sample.color * t.dist;
+	vec3f most = (atten * t.NL).multiply(kd).multiply(trans_loss).clamp() + (atten * t.RVn).multiply(ks).clamp();
+	t.bound = max(most[0], max(most[1], most[2]));
+}
 
 // Apply the phong model to this point on the surface of the object, returning
 // the color of that point.
@@ -21,25 +93,71 @@ vec3f Material::shade( Scene *scene, const ray& r, const isect& i) const
 	vec3f point = r.at(i.t);
 	vec3f I = ke;
 	vec3f trans_loss = vec3f(1.0, 1.0, 1.0) - kt;
-	list<Light*>::const_iterator begin, end;
 	//Ambient Shade
 	const AmbientLight *env = scene->getAmbientLight();
 	if(env) {
 		I += ka.multiply(env->getColor(vec3f())).multiply(trans_loss).clamp();
 	}
 
-	for(begin=scene->beginLights(), end=scene->endLights(); begin!=end; begin++) {
-		vec3f atten = (*begin)->shadowAttenuation(point) * (*begin)->distanceAttenuation(point);
-		vec3f L = (*begin)->getDirection(point);
-		double NL = i.N.dot(L);
+	// The light tree rules out whole clusters of lights that can't add
+	// anything here, or picks a few lights at random weighted to stand in
+	// for the rest.  Then every remaining light's unshadowed part comes
+	// first.  Lights that can't add anything get no shadow ray: those behind
+	// the surface with no highlight and spot lights whose cone misses the
+	// point.  Only lights that add exactly nothing are skipped, so the
+	// color is the same to the bit.  The rest are traced brightest first
+	// until the color saturates; the color is clamped to 1 when it is used,
+	// so after that more light can't change it.
+	vector<LightPick>& picks = light_picks;
+	const LightTree *tree = scene->getLightTree();
+	vec3f diffuse = kd.multiply(trans_loss);
+	double response = max(diffuse[0], max(diffuse[1], diffuse[2])) + max(ks[0], max(ks[1], ks[2]));
+	if(scene->getLightSamples() > 0) {
+		light_rng.setSeed(hashHit(point, r.getDirection()), 0);
+		tree->sample(point, response, 0.0, scene->getLightSamples(), light_rng, picks);
+	} else {
+		tree->cull(point, response, 0.0, picks);
+	}
+
+	vector<LightTerm>& terms = light_terms;
+	vector<LightTerm*>& order = light_order;
+	terms.clear();
+	for(size_t p = 0; p < picks.size(); p++) {
+		LightTerm t;
+		lightTerm(r, i, point, picks[p].light, t);
+		if(t.bound > 0.0) {
+			t.index = picks[p].index;
+			t.weight = picks[p].weight;
+			terms.push_back(t);
+		}
+	}
+	order.clear();
+	for(size_t k = 0; k < terms.size(); k++) {
+		order.push_back(&terms[k]);
+	}
+	std::sort(order.begin(), order.end(), brighter);
 
+	vec3f sum = I;
+	for(size_t k = 0; k < order.size(); k++) {
+		if(sum[0] > SATURATED && sum[1] > SATURATED && sum[2] > SATURATED) {
+			break;
+		}
+		LightTerm& t = *order[k];
+		vec3f atten = t.light->shadowAttenuation(t.sample) * t.dist;
 		//diffuse
-		I += (atten * NL).multiply(kd).multiply(trans_loss).clamp();
+		t.diffuse = (atten * t.NL).multiply(kd).multiply(trans_loss).clamp() * t.weight;
 		//specular
-		vec3f R = i.N * (2 * NL) - L;
-		double RV = max(0.0, -R.dot(r.getDirection()));
-		double n = shininess * 128;
-		I += (atten * pow(RV, n)).multiply(ks).clamp();
+		t.specular = (atten * t.RVn).multiply(ks).clamp() * t.weight;
+		t.lit = true;
+		sum += t.diffuse + t.specular;
+	}
+
+	// summed in the scene's light order, as ever, or the order picked
+	for(size_t k = 0; k < terms.size(); k++) {
+		if(terms[k].lit) {
+			I += terms[k].diffuse;
+			I += terms[k].specular;
+		}
 	}
 	return I;
 }
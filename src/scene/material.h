@@ -12,6 +12,8 @@
 class Scene;
 class ray;
 class isect;
+class Light;
+struct LightTerm;
 
 class Material
 {
@@ -32,6 +34,10 @@ public:
 
 	virtual vec3f shade( Scene *scene, const ray& r, const isect& i) const;
 
+private:
+	void lightTerm( const ray& r, const isect& i, const vec3f& point, const Light *light, LightTerm& t ) const;
+
+public:
     vec3f ke;                    // emissive
     vec3f ka;                    // ambient
     vec3f ks;                    // specular
@@ -1,18 +1,15 @@
+#include <atomic>
 #include <cmath>
 
 #include "scene.h"
 #include "light.h"
 #include "BSPTree.h"
+#include "Frustum.h"
+#include "LightTree.h"
 #include "../ui/TraceUI.h"
 extern TraceUI* traceUI;
 
 
-void BoundingBox::operator=(const BoundingBox& target)
-{
-	min = target.min;
-	max = target.max;
-}
-
 // Does this bounding box intersect the target?
 bool BoundingBox::intersects(const BoundingBox &target) const
 {
@@ -121,6 +118,12 @@ bool Geometry::hasBoundingBoxCapability() const
 	return false;
 }
 
+unsigned int Scene::newSerial()
+{
+	static std::atomic<unsigned int> next(1);
+	return next++;
+}
+
 Scene::~Scene()
 {
     giter g;
@@ -130,13 +133,8 @@ Scene::~Scene()
 		delete (*g);
 	}
 
-	for( g = boundedobjects.begin(); g != boundedobjects.end(); ++g ) {
-		delete (*g);
-	}
-
-	for( g = nonboundedobjects.begin(); g != boundedobjects.end(); ++g ) {
-		delete (*g);
-	}
+	// boundedobjects and nonboundedobjects only sort the pointers in
+	// objects, so they have already been freed
 
 	for( l = lights.begin(); l != lights.end(); ++l ) {
 		delete (*l);
@@ -148,6 +146,9 @@ Scene::~Scene()
 	if( bspTree) {
 		delete bspTree;
 	}
+	if( lightTree ) {
+		delete lightTree;
+	}
 }
 
 // Get any intersection with an object.  Return information about the 
@@ -195,6 +196,26 @@ bool Scene::intersect( const ray& r, isect& i ) const
 	return have_one;
 }
 
+bool Scene::intersectObject( const Geometry *obj, const ray& r, isect& i ) const
+{
+	if( BSPAccel && obj->hasBoundingBoxCapability() )
+		return bspTree->intersect( obj, r, i );
+	return obj->intersect( r, i );
+}
+
+void Scene::cull( const Frustum& f, vector<SceneCell>& cells ) const
+{
+	cells.clear();
+	if( BSPAccel ) {
+		bspTree->cull( f, cells );
+	} else if( !boundedobjects.empty() && f.overlaps( sceneBounds ) ) {
+		SceneCell c;
+		c.box = sceneBounds;
+		c.objects = &boundedobjects;
+		cells.push_back( c );
+	}
+}
+
 void Scene::initScene()
 {
 	bool first_boundedobject = true;
@@ -203,6 +224,8 @@ void Scene::initScene()
 	typedef list<Geometry*>::const_iterator iter;
 	// split the objects into two categories: bounded and non-bounded
 	for( iter j = objects.begin(); j != objects.end(); ++j ) {
+		(*j)->updateClosed();
+
 		if( (*j)->hasBoundingBoxCapability() )
 		{
 			boundedobjects.push_back(*j);
@@ -227,6 +250,10 @@ void Scene::initScene()
 	}
 	bspTree = new BSPTree(this);
 	bspTree->build();
+	if(!lightTree) {
+		lightTree = new LightTree(this);
+	}
+	lightTree->build();
 	if(!ambient_light) {
 		ambient_light = new AmbientLight(this, vec3f(0.0, 0.0, 0.0));
 	}
@@ -8,6 +8,7 @@
 #define __SCENE_H__
 
 #include <list>
+#include <vector>
 #include <algorithm>
 #include <queue>
 
@@ -19,8 +20,11 @@ using namespace std;
 #include "../vecmath/vecmath.h"
 
 class Light;
+class Frustum;
+class Geometry;
 class AmbientLight;
 class Scene;
+class LightTree;
 
 class SceneElement
 {
@@ -42,8 +46,6 @@ public:
 	vec3f min;
 	vec3f max;
 
-	void operator=(const BoundingBox& target);
-
 	// Does this bounding box intersect the target?
 	bool intersects(const BoundingBox &target) const;
 	
@@ -56,6 +58,13 @@ public:
 	bool intersect(const ray& r, double& tMin, double& tMax) const;
 };
 
+// A box of the scene's octree and the objects that reach into it.
+struct SceneCell
+{
+	BoundingBox box;
+	const list<Geometry*> *objects;
+};
+
 class TransformNode
 {
 protected:
@@ -149,6 +158,10 @@ public:
 
 	virtual bool hasBoundingBoxCapability() const;
 	const BoundingBox& getBoundingBox() const { return bounds; }
+
+	// For an object that is a flat triangle, its corners in world space.
+	// The rasterizer uses this to cover it more tightly than its box.
+	virtual bool getTriangle( vec3f&, vec3f&, vec3f& ) const { return false; }
 	virtual void ComputeBoundingBox()
     {
         // take the object's local bounding box, transform all 8 points on it,
@@ -195,12 +208,23 @@ public:
     virtual BoundingBox ComputeLocalBoundingBox() { return BoundingBox(); }
 
     void setTransform(TransformNode *transform) { this->transform = transform; };
+
+	// Whether the surface encloses a volume, so that a ray going in through
+	// it is inside until it comes out through it again.  The refraction
+	// stack in RayTracer::traceRay depends on this.  Scene::initScene
+	// caches encloses() here once the whole scene is loaded.
+	bool isClosed() const { return closed; }
+	void updateClosed() { closed = encloses(); }
+
+	// override for open surfaces
+	virtual bool encloses() const { return true; }
     
 	Geometry( Scene *scene ) 
-		: SceneElement( scene ) {}
+		: SceneElement( scene ), closed( true ) {}
 
 protected:
 	BoundingBox bounds;
+	bool closed;
     TransformNode *transform;
 };
 
@@ -253,7 +277,7 @@ public:
 
 public:
 	Scene() 
-		: transformRoot(), objects(), lights(), ambient_light(NULL), scale(1.87), BSPAccel(true), bspTree(NULL) {}
+		: transformRoot(), serial(newSerial()), objects(), lights(), ambient_light(NULL), bspTree(NULL), lightTree(NULL), BSPAccel(true), scale(1.87), scaleFactor(pow(10, 1.87)), lightSamples(0) {}
 	virtual ~Scene();
 
 	void add( Geometry* obj )
@@ -266,35 +290,62 @@ public:
 	void set( AmbientLight* light );
 	void setScale( double dis_scale ) {
 		scale = dis_scale;
+		scaleFactor = pow(10, scale);
 	}
 
 	bool intersect( const ray& r, isect& i ) const;
+	// What intersect() makes of obj on its own: the same hit, to the bit,
+	// if obj is what r hits first.
+	bool intersectObject( const Geometry *obj, const ray& r, isect& i ) const;
+	// The leaves of the octree with bounded objects that a ray of f could
+	// go through, or without the octree one cell with all of them.
+	void cull( const Frustum& f, vector<SceneCell>& cells ) const;
 	void initScene();
 
 	list<Light*>::const_iterator beginLights() const { return lights.begin(); }
 	list<Light*>::const_iterator endLights() const { return lights.end(); }
+
+	cgiter beginBoundedObjects() const { return boundedobjects.begin(); }
+	cgiter endBoundedObjects() const { return boundedobjects.end(); }
+	cgiter beginNonboundedObjects() const { return nonboundedobjects.begin(); }
+	cgiter endNonboundedObjects() const { return nonboundedobjects.end(); }
 	
 	const AmbientLight* getAmbientLight() const { return ambient_light; }
 	const BoundingBox getBound() const { return sceneBounds; }
         
 	Camera *getCamera() { return &camera; }
 	double getScale() { return scale; }
+	// pow(10, getScale()), the numerator of the lights' distance attenuation
+	double getScaleFactor() const { return scaleFactor; }
+	// shade with this many point and spot lights picked at random by
+	// importance instead of all of them, if > 0
+	void setLightSamples( int n ) { lightSamples = n; }
+	int getLightSamples() const { return lightSamples; }
+	const LightTree* getLightTree() const { return lightTree; }
 
 	void setBSP(bool s) { BSPAccel = s; }
+	// different for every scene made, so caches can tell scenes apart
+	unsigned int getSerial() const { return serial; }
 	
 	friend class BSPTree;
 private:
+	static unsigned int newSerial();
+
+	unsigned int serial;
     list<Geometry*> objects;
 	list<Geometry*> nonboundedobjects;
 	list<Geometry*> boundedobjects;
     list<Light*> lights;
     AmbientLight* ambient_light;
 	BSPTree* bspTree;
+	LightTree* lightTree;
     Camera camera;
 
 	bool BSPAccel;
 
 	double scale;
+	double scaleFactor;
+	int lightSamples;
 	
 	// Each object in the scene, provided that it has hasBoundingBoxCapability(),
 	// must fall within this bounding box.  Objects that don't have hasBoundingBoxCapability()
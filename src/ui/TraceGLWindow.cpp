@@ -6,6 +6,7 @@
 #include "../RayTracer.h"
 
 #include "../fileio/bitmap.h"
+#include "../fileio/pfm.h"
 
 TraceGLWindow::TraceGLWindow(int x, int y, int w, int h, const char *l)
 			: Fl_Gl_Window(x,y,w,h,l)
@@ -69,7 +70,11 @@ void TraceGLWindow::saveImage(char *iname)
 	unsigned char* buf;
 
 	raytracer->getBuffer(buf, m_nDrawWidth, m_nDrawHeight);
-	if (buf)
+
+	// .pfm keeps the unquantized float image
+	if (isPFMName(iname))
+		raytracer->saveHDR(iname);
+	else if (buf)
 		writeBMP(iname, m_nDrawWidth, m_nDrawHeight, buf); 
 }
 
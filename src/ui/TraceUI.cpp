@@ -55,7 +55,7 @@ void TraceUI::cb_save_image(Fl_Menu_* o, void* v)
 {
 	TraceUI* pUI=whoami(o);
 	
-	char* savefile = fl_file_chooser("Save Image?", "*.bmp", "save.bmp" );
+	char* savefile = fl_file_chooser("Save Image?", "*.{bmp,pfm}", "save.bmp" );
 	if (savefile != NULL) {
 		pUI->m_traceGlWindow->saveImage(savefile);
 	}
@@ -117,6 +117,22 @@ void TraceUI::cb_threshSlides(Fl_Widget* o, void* v)
 	((TraceUI*)(o->user_data()))->m_fThresh=float( ((Fl_Slider *)o)->value() ) ;
 }
 
+void TraceUI::cb_deadlineSlides(Fl_Widget* o, void* v)
+{
+	((TraceUI*)(o->user_data()))->m_fDeadline=float( ((Fl_Slider *)o)->value() ) ;
+}
+
+// Preview the shadows from depth maps of this size instead of tracing
+// them, 0 to trace.  The maps are made on the next Render and kept for
+// the ones after it until the size, the spot light cutoff or the scene
+// changes.
+void TraceUI::cb_shadowMapSlides(Fl_Widget* o, void* v)
+{
+	TraceUI* pUI=((TraceUI *)(o->user_data()));
+	pUI->m_nShadowMap=int( ((Fl_Slider *)o)->value() ) ;
+	pUI->raytracer->setShadowMaps(pUI->m_nShadowMap);
+}
+
 void TraceUI::cb_spotpSlides(Fl_Widget* o, void* v)
 {
 	TraceUI* pUI=((TraceUI *)(o->user_data()));
@@ -146,6 +162,13 @@ void TraceUI::cb_useBGCheck(Fl_Widget* o, void* v)
 	((TraceUI*)(o->user_data()))->raytracer->setBG(bool( ((Fl_Check_Button *)o)->value() )) ;
 }
 
+// Keep the first hits of a normal render, so that the next Render after
+// moving only the light, depth or threshold sliders just reshades them.
+void TraceUI::cb_gbufferCheck(Fl_Widget* o, void* v)
+{
+	((TraceUI*)(o->user_data()))->raytracer->setGBuffer(bool( ((Fl_Check_Button *)o)->value() )) ;
+}
+
 void TraceUI::cb_modeChoice(Fl_Widget* o, void* v)
 {
 	TraceUI* pUI=((TraceUI *)(o->user_data()));
@@ -161,10 +184,18 @@ void TraceUI::cb_modeChoice(Fl_Widget* o, void* v)
 	pUI->raytracer->setMode((enum TraceMode)type);
 }
 
-void TraceUI::cb_render(Fl_Widget* o, void* v)
+void TraceUI::cb_patternChoice(Fl_Widget* o, void* v)
 {
-	char buffer[256];
+	((TraceUI*)(o->user_data()))->raytracer->setSamplePattern((enum SamplePattern)(int)v);
+}
 
+void TraceUI::cb_scrambleCheck(Fl_Widget* o, void* v)
+{
+	((TraceUI*)(o->user_data()))->raytracer->setScramble(bool( ((Fl_Check_Button *)o)->value() )) ;
+}
+
+void TraceUI::cb_render(Fl_Widget* o, void* v)
+{
 	TraceUI* pUI=((TraceUI*)(o->user_data()));
 	
 	if (pUI->raytracer->sceneLoaded()) {
@@ -178,67 +209,138 @@ void TraceUI::cb_render(Fl_Widget* o, void* v)
 		pUI->raytracer->setSampleSize(pUI->getSampleSize());
 		pUI->raytracer->setDisp(pUI->getRayVisual());
 		pUI->raytracer->setAccel(pUI->getBSPAccel());
-		
-		// Save the window label
-		const char *old_label = pUI->m_traceGlWindow->label();
 
-		// start to render here	
-		done=false;
-		clock_t prev, now;
-		prev=clock();
-		
-		pUI->m_traceGlWindow->refresh();
-		Fl::check();
-		Fl::flush();
-
-		for (int y=0; y<height; y++) {
-			for (int x=0; x<width; x++) {
-				if (done) break;
-				
-				// current time
-				now = clock();
-
-				// check event every 1/2 second
-				if (((double)(now-prev)/CLOCKS_PER_SEC)>0.5) {
-					prev=now;
-
-					if (Fl::ready()) {
-						// refresh
-						pUI->m_traceGlWindow->refresh();
-						// check event
-						Fl::check();
-
-						if (Fl::damage()) {
-							Fl::flush();
-						}
-					}
-				}
+		if (pUI->raytracer->getMode() == TRACE_DEADLINE)
+			traceDeadline(pUI);
+		else
+			traceImage(pUI, width, height);
+	}
+}
 
-				pUI->raytracer->tracePixel( x, y );
-		
-			}
+// Trace one more pass over the image that is already on screen.  The new
+// samples are averaged into the existing ones instead of replacing them,
+// which refines the jittered modes.
+void TraceUI::cb_refine(Fl_Widget* o, void* v)
+{
+	TraceUI* pUI=((TraceUI*)(o->user_data()));
+
+	unsigned char* buf;
+	int width, height;
+	pUI->raytracer->getBuffer(buf, width, height);
+
+	if (pUI->raytracer->sceneLoaded() && buf) {
+		pUI->m_traceGlWindow->show();
+		traceImage(pUI, width, height);
+	}
+}
+
+// Trace every pixel of the current buffer, keeping the UI responsive and
+// the window label updated with the progress.
+void TraceUI::traceImage(TraceUI* pUI, int width, int height)
+{
+	char buffer[256];
+
+	// Save the window label
+	const char *old_label = pUI->m_traceGlWindow->label();
+
+	// start to render here	
+	done=false;
+	clock_t prev, now;
+	prev=clock();
+	
+	pUI->m_traceGlWindow->refresh();
+	Fl::check();
+	Fl::flush();
+
+	pUI->raytracer->prepareShadowMaps(NULL);
+	pUI->raytracer->prepareGBuffer(NULL);
+	pUI->raytracer->prepareTiles(NULL);
+
+	for (int y=0; y<height; y++) {
+		for (int x=0; x<width; x++) {
 			if (done) break;
+			
+			// current time
+			now = clock();
+
+			// check event every 1/2 second
+			if (((double)(now-prev)/CLOCKS_PER_SEC)>0.5) {
+				prev=now;
 
-			// flush when finish a row
-			if (Fl::ready()) {
-				// refresh
-				pUI->m_traceGlWindow->refresh();
+				if (Fl::ready()) {
+					// refresh
+					pUI->m_traceGlWindow->refresh();
+					// check event
+					Fl::check();
 
-				if (Fl::damage()) {
-					Fl::flush();
+					if (Fl::damage()) {
+						Fl::flush();
+					}
 				}
 			}
-			// update the window label
-			sprintf(buffer, "(%d%%) %s", (int)((double)y / (double)height * 100.0), old_label);
+
+			pUI->raytracer->tracePixel( x, y );
+	
+		}
+		if (done) break;
+
+		// flush when finish a row
+		if (Fl::ready()) {
+			// refresh
+			pUI->m_traceGlWindow->refresh();
+
+			if (Fl::damage()) {
+				Fl::flush();
+			}
+		}
+		// update the window label
+		sprintf(buffer, "(%d%%) %s", (int)((double)y / (double)height * 100.0), old_label);
+		pUI->m_traceGlWindow->label(buffer);
+		
+	}
+
+	// the variance mode goes on to refine its noisiest pixels, a round at a
+	// time, until they converge or Stop is pressed
+	if (pUI->raytracer->getMode() == TRACE_VARIANCE) {
+		int round = 0;
+		while (!done && pUI->raytracer->varianceRound(NULL) > 0) {
+			sprintf(buffer, "(refine %d) %s", ++round, old_label);
 			pUI->m_traceGlWindow->label(buffer);
-			
+			pUI->m_traceGlWindow->refresh();
+			Fl::check();
+			if (Fl::damage()) {
+				Fl::flush();
+			}
 		}
-		done=true;
+	}
+
+	done=true;
+	pUI->m_traceGlWindow->refresh();
+
+	// Restore the window label
+	pUI->m_traceGlWindow->label(old_label);		
+}
+
+// Render within the deadline set on the slider, showing every stage of
+// the image as it completes.  Stop keeps the current stage.
+void TraceUI::traceDeadline(TraceUI* pUI)
+{
+	done=false;
+	pUI->m_traceGlWindow->refresh();
+	Fl::check();
+	Fl::flush();
+
+	pUI->raytracer->traceDeadline(NULL, pUI->getDeadline(), [pUI]() {
 		pUI->m_traceGlWindow->refresh();
+		Fl::check();
+		if (Fl::damage()) {
+			Fl::flush();
+		}
+		return !done;
+	});
 
-		// Restore the window label
-		pUI->m_traceGlWindow->label(old_label);		
-	}
+	done=true;
+	pUI->m_traceGlWindow->refresh();
 }
 
 void TraceUI::cb_stop(Fl_Widget* o, void* v)
@@ -292,6 +394,11 @@ float TraceUI::getThresh()
 	return m_fThresh;
 }
 
+float TraceUI::getDeadline()
+{
+	return m_fDeadline;
+}
+
 // menu definition
 Fl_Menu_Item TraceUI::menuitems[] = {
 	{ "&File",		0, 0, 0, FL_SUBMENU },
@@ -312,10 +419,20 @@ Fl_Menu_Item TraceUI::traceModeMenu[NUM_TRACE_MODE+1] = {
 	{"Normal",						FL_ALT+'n', (Fl_Callback *)TraceUI::cb_modeChoice, (void *)TRACE_NORMAL},
 	{"Antialias Supersampling",	    FL_ALT+'s', (Fl_Callback *)TraceUI::cb_modeChoice, (void *)TRACE_ANTIALIAS_NORMAL},
 	{"Antialias Jittering",			FL_ALT+'j', (Fl_Callback *)TraceUI::cb_modeChoice, (void *)TRACE_JITTER},
-	{"Antialias Adaptive",			FL_ALT+'a', (Fl_Callback *)TraceUI::cb_modeChoice, (void *)TRACE_ADAPTIVE_ANTIALIAS},
+	{"Antialias Adaptive",			FL_ALT+'a', (Fl_Callback *)TraceUI::cb_modeChoice, (void *)TRACE_ADAPTIVE_ANTIALIAS},
+	{"Antialias Variance",			FL_ALT+'v', (Fl_Callback *)TraceUI::cb_modeChoice, (void *)TRACE_VARIANCE},
+	{"Deadline",					FL_ALT+'d', (Fl_Callback *)TraceUI::cb_modeChoice, (void *)TRACE_DEADLINE},
     {0}
 };
 
+Fl_Menu_Item TraceUI::samplePatternMenu[NUM_SAMPLE_PATTERN+1] = {
+	{"Mode Default",	0, (Fl_Callback *)TraceUI::cb_patternChoice, (void *)SAMPLE_DEFAULT},
+	{"Stratified",		0, (Fl_Callback *)TraceUI::cb_patternChoice, (void *)SAMPLE_STRATIFIED},
+	{"Halton",			0, (Fl_Callback *)TraceUI::cb_patternChoice, (void *)SAMPLE_HALTON},
+	{"Sobol",			0, (Fl_Callback *)TraceUI::cb_patternChoice, (void *)SAMPLE_SOBOL},
+    {0}
+};
+
 TraceUI::TraceUI() {
 	// init.
 	m_nDepth = 0;
@@ -327,7 +444,9 @@ TraceUI::TraceUI() {
 	m_nSpotP = 128;
 	m_fCutoff = 0.2;
 	m_fThresh = 0.00001;
-	m_mainWindow = new Fl_Window(100, 40, 380, 315, "Ray <Not Loaded>");
+	m_fDeadline = 2.0;
+	m_nShadowMap = 0;
+	m_mainWindow = new Fl_Window(100, 40, 380, 440, "Ray <Not Loaded>");
 		m_mainWindow->user_data((void*)(this));	// record self to be used by static callback functions
 		// install menu bar
 		m_menubar = new Fl_Menu_Bar(0, 0, 380, 25);
@@ -452,6 +571,54 @@ TraceUI::TraceUI() {
 		m_useBGButton->value(0);
 		m_useBGButton->callback(cb_useBGCheck);
 
+		// install sample pattern chooser
+		m_patternChooser = new Fl_Choice(10, 305, 180, 20, "Sample Pattern");
+		m_patternChooser->user_data((void*)(this));
+		m_patternChooser->labelfont(FL_COURIER);
+		m_patternChooser->menu(samplePatternMenu);
+		m_patternChooser->align(FL_ALIGN_RIGHT);
+		m_patternChooser->callback(cb_patternChoice);
+
+		// install scramble button
+		m_scrambleButton = new Fl_Check_Button(10, 330, 180, 20, "Scramble Per Pixel");
+		m_scrambleButton->user_data((void*)(this));
+		m_scrambleButton->labelfont(FL_COURIER);
+		m_scrambleButton->value(1);
+		m_scrambleButton->callback(cb_scrambleCheck);
+
+		// install slider deadline
+		m_deadlineSlider = new Fl_Value_Slider(10, 355, 180, 20, "Deadline");
+		m_deadlineSlider->user_data((void*)(this));	// record self to be used by static callback functions
+		m_deadlineSlider->type(FL_HOR_NICE_SLIDER);
+        m_deadlineSlider->labelfont(FL_COURIER);
+        m_deadlineSlider->labelsize(12);
+		m_deadlineSlider->minimum(0.1);
+		m_deadlineSlider->maximum(30);
+		m_deadlineSlider->step(0.1);
+		m_deadlineSlider->value(m_fDeadline);
+		m_deadlineSlider->align(FL_ALIGN_RIGHT);
+		m_deadlineSlider->callback(cb_deadlineSlides);
+
+		// install G-buffer button
+		m_gbufferButton = new Fl_Check_Button(10, 380, 180, 20, "Relight From G-Buffer");
+		m_gbufferButton->user_data((void*)(this));
+		m_gbufferButton->labelfont(FL_COURIER);
+		m_gbufferButton->value(0);
+		m_gbufferButton->callback(cb_gbufferCheck);
+
+		// install slider shadow map size
+		m_shadowMapSlider = new Fl_Value_Slider(10, 405, 180, 20, "Shadow Map Size");
+		m_shadowMapSlider->user_data((void*)(this));	// record self to be used by static callback functions
+		m_shadowMapSlider->type(FL_HOR_NICE_SLIDER);
+        m_shadowMapSlider->labelfont(FL_COURIER);
+        m_shadowMapSlider->labelsize(12);
+		m_shadowMapSlider->minimum(0);
+		m_shadowMapSlider->maximum(1024);
+		m_shadowMapSlider->step(64);
+		m_shadowMapSlider->value(m_nShadowMap);
+		m_shadowMapSlider->align(FL_ALIGN_RIGHT);
+		m_shadowMapSlider->callback(cb_shadowMapSlides);
+
 		m_renderButton = new Fl_Button(280, 52, 70, 25, "&Render");
 		m_renderButton->user_data((void*)(this));
 		m_renderButton->callback(cb_render);
@@ -460,6 +627,10 @@ TraceUI::TraceUI() {
 		m_stopButton->user_data((void*)(this));
 		m_stopButton->callback(cb_stop);
 
+		m_refineButton = new Fl_Button(280, 230, 70, 25, "Re&fine");
+		m_refineButton->user_data((void*)(this));
+		m_refineButton->callback(cb_refine);
+
 		m_mainWindow->callback(cb_exit2);
 		m_mainWindow->when(FL_HIDE);
     m_mainWindow->end();
@@ -29,6 +29,7 @@ public:
 	Fl_Menu_Bar*		m_menubar;
 
 	Fl_Choice*			m_modeChooser;
+	Fl_Choice*			m_patternChooser;
 
 	Fl_Slider*			m_sizeSlider;
 	Fl_Slider*			m_depthSlider;
@@ -37,13 +38,18 @@ public:
 	Fl_Slider*			m_cutoffSlider;
 	Fl_Slider*			m_sampleSlider;
 	Fl_Slider*			m_threshSlider;
+	Fl_Slider*			m_deadlineSlider;
+	Fl_Slider*			m_shadowMapSlider;
 
 	Fl_Check_Button*	m_rayVisualButton;
 	Fl_Check_Button*	m_bspAccelButton;
 	Fl_Check_Button*	m_useBGButton;
+	Fl_Check_Button*	m_scrambleButton;
+	Fl_Check_Button*	m_gbufferButton;
 
 	Fl_Button*			m_renderButton;
 	Fl_Button*			m_stopButton;
+	Fl_Button*			m_refineButton;
 
 	TraceGLWindow*		m_traceGlWindow;
 
@@ -56,6 +62,7 @@ public:
 	int			getDepth();
 	float		getDistScale();
 	float		getThresh();
+	float		getDeadline();
 	int			getSampleSize();
 	bool		getRayVisual();
 	bool		getBSPAccel();
@@ -70,12 +77,15 @@ private:
 	float		m_fDisScale;
 	float		m_fCutoff;
 	float		m_fThresh;
+	float		m_fDeadline;
+	int			m_nShadowMap;
 	bool		m_bRayVisual;
 	bool		m_bBSPAccel;
 
 // static class members
 	static Fl_Menu_Item menuitems[];
 	static Fl_Menu_Item traceModeMenu[NUM_TRACE_MODE+1];
+	static Fl_Menu_Item samplePatternMenu[NUM_SAMPLE_PATTERN+1];
 
 	static TraceUI* whoami(Fl_Menu_* o);
 
@@ -88,6 +98,8 @@ private:
 	static void cb_exit2(Fl_Widget* o, void* v);
 
 	static void cb_modeChoice(Fl_Widget* o, void* v);
+	static void cb_patternChoice(Fl_Widget* o, void* v);
+	static void cb_scrambleCheck(Fl_Widget* o, void* v);
 
 	static void cb_sizeSlides(Fl_Widget* o, void* v);
 	static void cb_depthSlides(Fl_Widget* o, void* v);
@@ -96,13 +108,20 @@ private:
 	static void cb_cutoffSlides(Fl_Widget* o, void* v);
 	static void cb_sampleSizeSlides(Fl_Widget* o, void* v);
 	static void cb_threshSlides(Fl_Widget* o, void *v);
+	static void cb_deadlineSlides(Fl_Widget* o, void *v);
+	static void cb_shadowMapSlides(Fl_Widget* o, void *v);
 
 	static void cb_rayVisualCheck(Fl_Widget* o, void* v);
 	static void cb_BSPAccelCheck(Fl_Widget* o, void* v);
 	static void cb_useBGCheck(Fl_Widget* o, void* v);
+	static void cb_gbufferCheck(Fl_Widget* o, void* v);
 
 	static void cb_render(Fl_Widget* o, void* v);
 	static void cb_stop(Fl_Widget* o, void* v);
+	static void cb_refine(Fl_Widget* o, void* v);
+
+	static void traceImage(TraceUI* pUI, int width, int height);
+	static void traceDeadline(TraceUI* pUI);
 };
 
 #endif